@@ -4,6 +4,15 @@
 #include <cstdio>
 #include <fstream>
 #include <chrono>
+#include <algorithm>
+
+#include "../../OpenCL_Common/async.h"
+#include "../../OpenCL_Common/service.h"
+#include "../../OpenCL_Common/kernels.h"
+#include "../../OpenCL_Common/perf.h"
+#include "../../OpenCL_Common/memory.h"
+#include "../../OpenCL_Common/reduce.h"
+#include "../../OpenCL_Common/verify.h"
 
 
 #define RET_CODE_CHECK(retCode, func)                                      \
@@ -33,7 +42,7 @@ template <typename FPType>
 auto omp_axpy(const size_t n, const FPType a, const FPType *x, const size_t incx, FPType *y, const size_t incy) {
     int i;
     auto t0 = std::chrono::steady_clock::now();
-#pragma omp parallel for shared (y, x ,a, n, incx, incy) private(i)
+#pragma omp parallel for schedule(static) shared (y, x ,a, n, incx, incy) private(i)
     for (i = 0; i < n; ++i)
     if (i * incy < n && i * incx < n)
         y[i * incy] = y[i * incy] + a * x[i * incx];
@@ -45,10 +54,7 @@ auto omp_axpy(const size_t n, const FPType a, const FPType *x, const size_t incx
 
 template <typename FPType>
 std::string readKernel() {
-    std::ifstream ifs(sizeof(FPType) == sizeof(double) ? "daxpy_kernel.cl" : "saxpy_kernel.cl");
-    std::string content{ std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>() };
-
-    return content;
+    return kernelSource(sizeof(FPType) == sizeof(double) ? "daxpy_kernel.cl" : "saxpy_kernel.cl");
 }
 
 
@@ -107,19 +113,20 @@ void setKernelArguments(const size_t n, const FPType a, const FPType* x, const s
     RET_CODE_CHECK(retCode, clGetKernelWorkGroupInfo(kernel, gpu, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &groupSize, 0))
     // groupSize = 8;
     size_t biteSize = sizeof(FPType) * (n / groupSize + !!(n % groupSize)) * groupSize;
+    size_t hostBiteSize = sizeof(FPType) * n;
 
     RET_CODE_CHECK(retCode, clSetKernelArg(kernel, 0, sizeof(size_t), &n))
 
     RET_CODE_CHECK(retCode, clSetKernelArg(kernel, 1, sizeof(FPType), &a))
 
     RET_CODE_RETURN_CHECK(retCode, clCreateBuffer(context, CL_MEM_READ_ONLY, biteSize, 0, &retCode), xBuffer)
-    RET_CODE_CHECK(retCode, clEnqueueWriteBuffer(queue, xBuffer, CL_TRUE, 0, biteSize, x, 0, 0, 0))
+    RET_CODE_CHECK(retCode, clEnqueueWriteBuffer(queue, xBuffer, CL_TRUE, 0, hostBiteSize, x, 0, 0, 0))
     RET_CODE_CHECK(retCode, clSetKernelArg(kernel, 2, sizeof(cl_mem), &xBuffer))
 
     RET_CODE_CHECK(retCode, clSetKernelArg(kernel, 3, sizeof(size_t), &incx))
 
     RET_CODE_RETURN_CHECK(retCode, clCreateBuffer(context, CL_MEM_READ_WRITE, biteSize, 0, &retCode), yBuffer)
-    RET_CODE_CHECK(retCode, clEnqueueWriteBuffer(queue, yBuffer, CL_TRUE, 0, biteSize, y, 0, 0, 0))
+    RET_CODE_CHECK(retCode, clEnqueueWriteBuffer(queue, yBuffer, CL_TRUE, 0, hostBiteSize, y, 0, 0, 0))
     RET_CODE_CHECK(retCode, clSetKernelArg(kernel, 4, sizeof(cl_mem), &yBuffer))
 
     RET_CODE_CHECK(retCode, clSetKernelArg(kernel, 5, sizeof(size_t), &incy))
@@ -138,7 +145,7 @@ auto opencl_axpy(const size_t n, const FPType a, const FPType* x, const size_t i
     cl_int retCode = 0;
     size_t groupSize = 0;
 
-    initializeKernel<FPType>(kernel, context, queue, gpu, program, retCode);
+    initializeKernel<FPType>(kernel, context, queue, gpu, program, retCode, deviceType);
     setKernelArguments(n, a, x, incx, y, incy, kernel, context, queue, gpu, retCode, xBuffer, yBuffer, groupSize);
 
     size_t nWorkItems = (n / groupSize + !!(n % groupSize)) * groupSize;
@@ -149,6 +156,7 @@ auto opencl_axpy(const size_t n, const FPType a, const FPType* x, const size_t i
     auto time = std::chrono::steady_clock::now() - t0;
     RET_CODE_CHECK(retCode, clEnqueueReadBuffer(queue, yBuffer, CL_TRUE, 0, sizeof(FPType) * n, y, 0, 0, 0))
 
+    clReleaseEvent(event);
     clReleaseMemObject(xBuffer);
     clReleaseMemObject(yBuffer);
     clReleaseProgram(program);
@@ -157,4 +165,92 @@ auto opencl_axpy(const size_t n, const FPType a, const FPType* x, const size_t i
     clReleaseContext(context);
 
     return time;
-}
\ No newline at end of file
+}
+
+
+// Enqueues upload, launch and read-back without blocking; y holds the result once the returned
+// event completes, and x, y must stay alive until then. AXPYs on disjoint vectors overlap.
+template <typename FPType>
+AsyncEvent opencl_axpy_async(AsyncScheduler& scheduler, const size_t n, const FPType a, const FPType* x,
+                             const size_t incx, FPType* y, const size_t incy) {
+    if (!scheduler.valid()) return AsyncEvent();
+
+    cl_kernel kernel = sizeof(FPType) == sizeof(double) ? scheduler.kernel("daxpy_kernel.cl", "daxpy")
+                                                        : scheduler.kernel("saxpy_kernel.cl", "saxpy");
+    size_t groupSize = 0;
+    clGetKernelWorkGroupInfo(kernel, scheduler.device(), CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &groupSize, 0);
+    const size_t biteSize = sizeof(FPType) * n;
+
+    AsyncBuffer xBuffer = scheduler.createBuffer(CL_MEM_READ_ONLY, biteSize);
+    AsyncBuffer yBuffer = scheduler.createBuffer(CL_MEM_READ_WRITE, biteSize);
+    scheduler.write(xBuffer, x, biteSize);
+    scheduler.write(yBuffer, y, biteSize);
+
+    asyncCheck(clSetKernelArg(kernel, 0, sizeof(size_t), &n), "clSetKernelArg n");
+    asyncCheck(clSetKernelArg(kernel, 1, sizeof(FPType), &a), "clSetKernelArg a");
+    asyncCheck(clSetKernelArg(kernel, 2, sizeof(cl_mem), xBuffer.memPtr()), "clSetKernelArg x");
+    asyncCheck(clSetKernelArg(kernel, 3, sizeof(size_t), &incx), "clSetKernelArg incx");
+    asyncCheck(clSetKernelArg(kernel, 4, sizeof(cl_mem), yBuffer.memPtr()), "clSetKernelArg y");
+    asyncCheck(clSetKernelArg(kernel, 5, sizeof(size_t), &incy), "clSetKernelArg incy");
+
+    size_t nWorkItems = (n / groupSize + !!(n % groupSize)) * groupSize;
+    scheduler.launch(kernel, 1, &nWorkItems, &groupSize, {&xBuffer}, {&yBuffer});
+
+    return scheduler.read(yBuffer, y, biteSize);
+}
+
+
+// Thread-safe variant of opencl_axpy: runs on one of the service's dispatcher threads with the
+// shared context and program, so concurrent callers neither create contexts nor rebuild. A hot
+// (incx, incy) runs a kernel specialized for it over exactly the active work-items. n is not
+// part of the shape: the specialized kernel has no use for it, so every length shares one program.
+template <typename FPType>
+std::future<ComputeService::Duration> opencl_axpy_shared(ComputeService& service, const size_t n, const FPType a,
+                                                         const FPType* x, const size_t incx, FPType* y, const size_t incy) {
+    return service.submit([=](ServiceWorker& worker) {
+        // Zero-length buffers are invalid and there would be no work-items to launch.
+        if (n == 0) return ComputeService::Duration{};
+
+        cl_int retCode = 0;
+        const size_t biteSize = sizeof(FPType) * n;
+        const std::string shape = incx && incy ? shapeOptions({{"INCX", incx}, {"INCY", incy}}) : std::string();
+        bool specialized = false;
+        cl_kernel kernel = sizeof(FPType) == sizeof(double) ? worker.specializedKernel("daxpy_kernel.cl", "daxpy", shape, &specialized)
+                                                            : worker.specializedKernel("saxpy_kernel.cl", "saxpy", shape, &specialized);
+        cl_command_queue queue = worker.queue();
+        size_t groupSize = 0;
+        if (kernel)
+            clGetKernelWorkGroupInfo(kernel, worker.device(), CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &groupSize, 0);
+        // A program that failed to build stays cached, so every later job would fail the same way.
+        if (!groupSize) serviceFail("opencl_axpy_shared: the axpy kernel is not available");
+
+        cl_mem xBuffer = clCreateBuffer(worker.context(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, biteSize, (void*)x, &retCode);
+        asyncCheck(retCode, "clCreateBuffer x");
+        cl_mem yBuffer = clCreateBuffer(worker.context(), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, biteSize, y, &retCode);
+        asyncCheck(retCode, "clCreateBuffer y");
+
+        asyncCheck(clSetKernelArg(kernel, 0, sizeof(size_t), &n), "clSetKernelArg n");
+        asyncCheck(clSetKernelArg(kernel, 1, sizeof(FPType), &a), "clSetKernelArg a");
+        asyncCheck(clSetKernelArg(kernel, 2, sizeof(cl_mem), &xBuffer), "clSetKernelArg x");
+        asyncCheck(clSetKernelArg(kernel, 3, sizeof(size_t), &incx), "clSetKernelArg incx");
+        asyncCheck(clSetKernelArg(kernel, 4, sizeof(cl_mem), &yBuffer), "clSetKernelArg y");
+        asyncCheck(clSetKernelArg(kernel, 5, sizeof(size_t), &incy), "clSetKernelArg incy");
+
+        size_t nWorkItems = (n / groupSize + !!(n % groupSize)) * groupSize;
+        if (specialized)
+            nWorkItems = std::min((n + incx - 1) / incx, (n + incy - 1) / incy);
+        cl_event event;
+        auto t0 = std::chrono::steady_clock::now();
+        asyncCheck(clEnqueueNDRangeKernel(queue, kernel, 1, 0, &nWorkItems, specialized ? nullptr : &groupSize, 0, 0, &event),
+                   "clEnqueueNDRangeKernel");
+        clWaitForEvents(1, &event);
+        auto time = std::chrono::steady_clock::now() - t0;
+        asyncCheck(clEnqueueReadBuffer(queue, yBuffer, CL_TRUE, 0, biteSize, y, 0, 0, 0), "clEnqueueReadBuffer");
+
+        clReleaseEvent(event);
+        clReleaseMemObject(xBuffer);
+        clReleaseMemObject(yBuffer);
+
+        return time;
+    });
+}
@@ -1,7 +1,14 @@
 #pragma OPENCL EXTENSION cl_khr_fp64 : enable
 
-__kernel void daxpy(const size_t n, const double a, __global const double *x, const size_t incx, __global double *y, const size_t incy) {
+// Built with -D INCX=<incx> -D INCY=<incy> for hot strides (KernelJit), the strides are
+// constants and the host launches exactly the active work-items, so there is no bounds check.
+__kernel void daxpy(const size_t nArg, const double a, __global const double *x, const size_t incxArg, __global double *y, const size_t incyArg) {
     int i = get_global_id(0);
+#ifdef INCX
+    const size_t incx = INCX, incy = INCY;
+#else
+    const size_t n = nArg, incx = incxArg, incy = incyArg;
     if (i * incy < n && i * incx < n)
+#endif
          y[i * incy] = y[i * incy] + a * x[i * incx];
 }
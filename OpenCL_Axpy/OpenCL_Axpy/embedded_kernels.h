@@ -0,0 +1,243 @@
+// Generated from the .cl files by OpenCL_Common/embed_kernels.ps1, do not edit.
+#pragma once
+
+#include "../../OpenCL_Common/kernels.h"
+
+static const EmbeddedKernel daxpy_kernel_embedded("daxpy_kernel.cl",
+    R"CLSRC(#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+
+// Built with -D INCX=<incx> -D INCY=<incy> for hot strides (KernelJit), the strides are
+// constants and the host launches exactly the active work-items, so there is no bounds check.
+__kernel void daxpy(const size_t nArg, const double a, __global const double *x, const size_t incxArg, __global double *y, const size_t incyArg) {
+    int i = get_global_id(0);
+#ifdef INCX
+    const size_t incx = INCX, incy = INCY;
+#else
+    const size_t n = nArg, incx = incxArg, incy = incyArg;
+    if (i * incy < n && i * incx < n)
+#endif
+         y[i * incy] = y[i * incy] + a * x[i * incx];
+}
+)CLSRC"
+);
+
+static const EmbeddedKernel reduce_kernel_embedded("reduce_kernel.cl",
+    R"CLSRC(// Two-stage reductions: every work-group of the *_partial kernels reduces a grid-stride slice of
+// the input to one partial, and the *_final kernels, launched as a single work-group, reduce the
+// partials. Build options: -D USE_DOUBLE, -D KAHAN (compensated per-work-item sums) and
+// -D USE_SUBGROUPS (cl_khr_subgroups, OpenCL C 2.0).
+
+#ifdef USE_DOUBLE
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+typedef double real;
+#else
+typedef float real;
+#endif
+
+#ifdef USE_SUBGROUPS
+#pragma OPENCL EXTENSION cl_khr_subgroups : enable
+#endif
+
+
+typedef struct {
+    real sum;
+    real compensation;
+} accumulator;
+
+void accumulate(accumulator *acc, const real value) {
+#ifdef KAHAN
+    const real y = value - acc->compensation;
+    const real t = acc->sum + y;
+    acc->compensation = (t - acc->sum) - y;
+    acc->sum = t;
+#else
+    acc->sum += value;
+#endif
+}
+
+real accumulated(const accumulator acc) {
+    return acc.sum - acc.compensation;
+}
+
+
+// Pairwise tree over `count` entries of scratch; count need not be a power of two.
+real treeReduceSum(__local real *scratch, const uint count) {
+    const uint lid = get_local_id(0);
+    for (uint active = count; active > 1; ) {
+        const uint half = (active + 1) / 2;
+        if (lid < active - half)
+            scratch[lid] += scratch[lid + half];
+        barrier(CLK_LOCAL_MEM_FENCE);
+        active = half;
+    }
+
+    return scratch[0];
+}
+
+real groupReduceSum(real value, __local real *scratch) {
+#ifdef USE_SUBGROUPS
+    value = sub_group_reduce_add(value);
+    if (get_sub_group_local_id() == 0)
+        scratch[get_sub_group_id()] = value;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    const real result = treeReduceSum(scratch, get_num_sub_groups());
+#else
+    scratch[get_local_id(0)] = value;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    const real result = treeReduceSum(scratch, get_local_size(0));
+#endif
+    // scratch may be reused by the caller right away.
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    return result;
+}
+
+
+// (value, index) pairs for iamax: the larger value wins, the smaller index breaks ties, so the
+// result is the first index of the maximum as in BLAS.
+bool better(const real value, const ulong index, const real bestValue, const ulong bestIndex) {
+    return value > bestValue || (value == bestValue && index < bestIndex);
+}
+
+void groupReduceMax(real *value, ulong *index, __local real *scratchValue, __local ulong *scratchIndex) {
+    const uint lid = get_local_id(0);
+#ifdef USE_SUBGROUPS
+    const real subMax = sub_group_reduce_max(*value);
+    const ulong subIndex = sub_group_reduce_min(*value == subMax ? *index : ULONG_MAX);
+    if (get_sub_group_local_id() == 0) {
+        scratchValue[get_sub_group_id()] = subMax;
+        scratchIndex[get_sub_group_id()] = subIndex;
+    }
+    uint active = get_num_sub_groups();
+#else
+    scratchValue[lid] = *value;
+    scratchIndex[lid] = *index;
+    uint active = get_local_size(0);
+#endif
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    while (active > 1) {
+        const uint half = (active + 1) / 2;
+        if (lid < active - half &&
+            better(scratchValue[lid + half], scratchIndex[lid + half], scratchValue[lid], scratchIndex[lid])) {
+            scratchValue[lid] = scratchValue[lid + half];
+            scratchIndex[lid] = scratchIndex[lid + half];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+        active = half;
+    }
+
+    *value = scratchValue[0];
+    *index = scratchIndex[0];
+}
+
+
+__kernel void dot_partial(const ulong count, __global const real *x, const ulong incx, __global const real *y,
+                          const ulong incy, __global real *partial, __local real *scratch) {
+    accumulator acc = {0, 0};
+    for (ulong i = get_global_id(0); i < count; i += get_global_size(0))
+        accumulate(&acc, x[i * incx] * y[i * incy]);
+
+    const real result = groupReduceSum(accumulated(acc), scratch);
+    if (get_local_id(0) == 0)
+        partial[get_group_id(0)] = result;
+}
+
+__kernel void nrm2_partial(const ulong count, __global const real *x, const ulong incx,
+                           __global real *partial, __local real *scratch) {
+    accumulator acc = {0, 0};
+    for (ulong i = get_global_id(0); i < count; i += get_global_size(0))
+        accumulate(&acc, x[i * incx] * x[i * incx]);
+
+    const real result = groupReduceSum(accumulated(acc), scratch);
+    if (get_local_id(0) == 0)
+        partial[get_group_id(0)] = result;
+}
+
+__kernel void asum_partial(const ulong count, __global const real *x, const ulong incx,
+                           __global real *partial, __local real *scratch) {
+    accumulator acc = {0, 0};
+    for (ulong i = get_global_id(0); i < count; i += get_global_size(0))
+        accumulate(&acc, fabs(x[i * incx]));
+
+    const real result = groupReduceSum(accumulated(acc), scratch);
+    if (get_local_id(0) == 0)
+        partial[get_group_id(0)] = result;
+}
+
+__kernel void sum_partial(const ulong count, __global const real *x, const ulong incx,
+                          __global real *partial, __local real *scratch) {
+    accumulator acc = {0, 0};
+    for (ulong i = get_global_id(0); i < count; i += get_global_size(0))
+        accumulate(&acc, x[i * incx]);
+
+    const real result = groupReduceSum(accumulated(acc), scratch);
+    if (get_local_id(0) == 0)
+        partial[get_group_id(0)] = result;
+}
+
+__kernel void sum_final(const ulong count, __global const real *partial, __global real *result,
+                        __local real *scratch) {
+    accumulator acc = {0, 0};
+    for (ulong i = get_local_id(0); i < count; i += get_local_size(0))
+        accumulate(&acc, partial[i]);
+
+    const real total = groupReduceSum(accumulated(acc), scratch);
+    if (get_local_id(0) == 0)
+        result[0] = total;
+}
+
+
+__kernel void iamax_partial(const ulong count, __global const real *x, const ulong incx,
+                            __global real *partialValue, __global ulong *partialIndex,
+                            __local real *scratchValue, __local ulong *scratchIndex) {
+    real bestValue = -1;
+    ulong bestIndex = ULONG_MAX;
+    for (ulong i = get_global_id(0); i < count; i += get_global_size(0)) {
+        const real value = fabs(x[i * incx]);
+        if (better(value, i, bestValue, bestIndex)) {
+            bestValue = value;
+            bestIndex = i;
+        }
+    }
+
+    groupReduceMax(&bestValue, &bestIndex, scratchValue, scratchIndex);
+    if (get_local_id(0) == 0) {
+        partialValue[get_group_id(0)] = bestValue;
+        partialIndex[get_group_id(0)] = bestIndex;
+    }
+}
+
+__kernel void iamax_final(const ulong count, __global const real *partialValue, __global const ulong *partialIndex,
+                          __global ulong *result, __local real *scratchValue, __local ulong *scratchIndex) {
+    real bestValue = -1;
+    ulong bestIndex = ULONG_MAX;
+    for (ulong i = get_local_id(0); i < count; i += get_local_size(0)) {
+        if (better(partialValue[i], partialIndex[i], bestValue, bestIndex)) {
+            bestValue = partialValue[i];
+            bestIndex = partialIndex[i];
+        }
+    }
+
+    groupReduceMax(&bestValue, &bestIndex, scratchValue, scratchIndex);
+    if (get_local_id(0) == 0)
+        result[0] = bestIndex;
+}
+)CLSRC"
+);
+
+static const EmbeddedKernel saxpy_kernel_embedded("saxpy_kernel.cl",
+    R"CLSRC(// Built with -D INCX=<incx> -D INCY=<incy> for hot strides (KernelJit), the strides are
+// constants and the host launches exactly the active work-items, so there is no bounds check.
+__kernel void saxpy(const size_t nArg, const float a, __global const float *x, const size_t incxArg, __global float *y, const size_t incyArg) {
+    int i = get_global_id(0);
+#ifdef INCX
+    const size_t incx = INCX, incy = INCY;
+#else
+    const size_t n = nArg, incx = incxArg, incy = incyArg;
+    if (i * incy < n && i * incx < n)
+#endif
+         y[i * incy] = y[i * incy] + a * x[i * incx];
+}
+)CLSRC"
+);
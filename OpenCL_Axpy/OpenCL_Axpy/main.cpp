@@ -1,11 +1,29 @@
 #include "axpy.h"
+#include "embedded_kernels.h"
 
 typedef float FPType;
 
+void verify_axpy(Verifier& verifier);
+void verify_reductions(Verifier& verifier);
+
 int main() {
+    requestThreadBinding();
+    Verifier verifier;
+    TimingBaseline baseline("axpy_baseline.json");
+    const bool hasGPU = deviceAvailable(CL_DEVICE_TYPE_GPU);
+
+    std::cout << "Verification:" << std::endl;
+    verify_verifier(verifier);
+    verify_axpy(verifier);
+    verify_reductions(verifier);
+    std::cout << std::endl;
+
     const size_t n = static_cast<size_t>(10e+7), incx = 1, incy = 1;
     const FPType a = static_cast<FPType>(1);
-    FPType *x = new FPType[n], *y = new FPType[n];
+    HostBuffer<FPType> xMemory(n), yMemory(n);
+    FPType *x = xMemory.data(), *y = yMemory.data();
+    firstTouch(x, n);
+    firstTouch(y, n);
 
     for (size_t i = 0; i < n; ++i) {
         x[i] = static_cast<FPType>(1);
@@ -20,8 +38,11 @@ int main() {
         std::cout << " " << y[i];
     std::cout << std::endl;
 
+    // Nominal work and traffic of one AXPY (read x and y, write y) for the hardware counter report
+    const double axpyFlops = 2.0 * n, axpyBytes = 3.0 * sizeof(FPType) * n;
+
     // CPU
-    auto cpuTime = cpu_axpy(n, a, x, incx, y, incy);
+    auto cpuTime = measureCounters("cpu_axpy", axpyFlops, axpyBytes, [&]() { return cpu_axpy(n, a, x, incx, y, incy); });
 
     std::cout << "CPU result:";
     for (size_t i = 0; i < 10; ++i)
@@ -43,32 +64,248 @@ int main() {
         y[i] = static_cast<FPType>(2);
 
     // OpenCL GPU
-    auto openCLGPUTime = opencl_axpy(n, a, x, incx, y, incy);
+    decltype(cpuTime) openCLGPUTime{};
+    if (hasGPU) {
+        openCLGPUTime = opencl_axpy(n, a, x, incx, y, incy);
 
-    std::cout << "OpenCL GPU result:";
-    for (size_t i = 0; i < 10; ++i)
-        std::cout << " " << y[i];
-    std::cout << std::endl;
+        std::cout << "OpenCL GPU result:";
+        for (size_t i = 0; i < 10; ++i)
+            std::cout << " " << y[i];
+        std::cout << std::endl;
 
-    for (size_t i = 0; i < n; ++i)
-        y[i] = static_cast<FPType>(2);
+        for (size_t i = 0; i < n; ++i)
+            y[i] = static_cast<FPType>(2);
+    }
 
     // OpenMP
-    auto ompTime = omp_axpy(n, a, x, incx, y, incy);
+    auto ompTime = measureCounters("omp_axpy", axpyFlops, axpyBytes, [&]() { return omp_axpy(n, a, x, incx, y, incy); });
 
     std::cout << "OpenMP result:";
     for (size_t i = 0; i < 10; ++i)
         std::cout << " " << y[i];
     std::cout << std::endl;
 
+    for (size_t i = 0; i < n; ++i)
+        y[i] = static_cast<FPType>(2);
+
+    // NUMA placement: omp_axpy on the first-touched x, y against serially initialized and
+    // interleaved copies. The numbers only differ on multi-socket machines.
+    printThreadPlacement();
+    auto axpyBandwidth = [&](FPType *xs, FPType *ys) {
+        const auto time = omp_axpy(n, a, xs, incx, ys, incy);
+        return axpyBytes / std::max(1e-9, std::chrono::duration<double>(time).count()) / 1e9;
+    };
+    const double firstTouchBandwidth = axpyBandwidth(x, y);
+    double placementBandwidth[2] = {};
+    const NumaPlacement placements[2] = {NumaPlacement::FirstTouch, NumaPlacement::Interleave};
+    for (int p = 0; p < 2; ++p) {
+        HostBuffer<FPType> xs(n, hostMemory(4096, HugePages::Transparent, placements[p]));
+        HostBuffer<FPType> ys(n, hostMemory(4096, HugePages::Transparent, placements[p]));
+        // Serial fill: without interleaving every page lands on the main thread's node.
+        for (size_t i = 0; i < n; ++i) {
+            xs[i] = static_cast<FPType>(1);
+            ys[i] = static_cast<FPType>(2);
+        }
+        placementBandwidth[p] = axpyBandwidth(xs.data(), ys.data());
+    }
+    std::cout << "OpenMP AXPY bandwidth:\n"
+              << "serial init  " << placementBandwidth[0] << " GB/s\n"
+              << "first-touch  " << firstTouchBandwidth << " GB/s\n"
+              << "interleaved  " << placementBandwidth[1] << " GB/s\n";
+
+    for (size_t i = 0; i < n; ++i)
+        y[i] = static_cast<FPType>(2);
+
+    // OpenCL async: independent AXPYs on disjoint chunks overlap their transfers and kernels
+    std::chrono::steady_clock::duration openCLAsyncTime{};
+    if (hasGPU || deviceAvailable(CL_DEVICE_TYPE_CPU)) {
+        const size_t nChunks = 4, chunk = n / nChunks;
+        AsyncScheduler scheduler(hasGPU ? CL_DEVICE_TYPE_GPU : CL_DEVICE_TYPE_CPU);
+        scheduler.kernel(sizeof(FPType) == sizeof(double) ? "daxpy_kernel.cl" : "saxpy_kernel.cl",
+                         sizeof(FPType) == sizeof(double) ? "daxpy" : "saxpy");
+
+        auto t0 = std::chrono::steady_clock::now();
+        std::vector<AsyncEvent> done;
+        for (size_t i = 0; i < nChunks; ++i) {
+            const size_t offset = i * chunk, length = (i + 1 == nChunks) ? n - offset : chunk;
+            done.push_back(opencl_axpy_async(scheduler, length, a, x + offset, incx, y + offset, incy));
+        }
+        waitAll(done);
+        openCLAsyncTime = std::chrono::steady_clock::now() - t0;
+
+        std::cout << "OpenCL async result:";
+        for (size_t i = 0; i < 10; ++i)
+            std::cout << " " << y[i];
+        std::cout << std::endl;
+    } else {
+        std::cout << "OpenCL async: SKIPPED (no device)" << std::endl;
+    }
+
+    // Reductions: one pass over the vectors, so GB/s is the figure to compare with memory bandwidth
+    FPType dot = 0, asum = 0;
+    auto ompDotTime = omp_dot(n, x, incx, y, incy, dot);
+    auto ompAsumTime = omp_asum(n, y, incy, asum);
+    auto openCLCPUDotTime = opencl_dot(n, x, incx, y, incy, dot, CL_DEVICE_TYPE_CPU);
+    decltype(ompDotTime) openCLGPUDotTime{};
+    if (hasGPU) openCLGPUDotTime = opencl_dot(n, x, incx, y, incy, dot);
+
+    auto bandwidth = [](const size_t bytes, const decltype(ompDotTime) time) {
+        return bytes / std::max(1e-9, std::chrono::duration<double>(time).count()) / 1e9;
+    };
+    std::cout << "Reductions (dot = " << dot << ", asum = " << asum << "):\n"
+              << "OpenMP dot        " << bandwidth(2 * sizeof(FPType) * n, ompDotTime) << " GB/s\n"
+              << "OpenMP asum       " << bandwidth(sizeof(FPType) * n, ompAsumTime) << " GB/s\n"
+              << "OpenCL CPU dot    " << bandwidth(2 * sizeof(FPType) * n, openCLCPUDotTime) << " GB/s\n"
+              << "OpenCL GPU dot    " << bandwidth(2 * sizeof(FPType) * n, openCLGPUDotTime) << " GB/s\n";
+
     // Total
     std::cout << "Time:\n"
               << "CPU        " << std::chrono::duration_cast<std::chrono::milliseconds>(cpuTime).count() << " ms\n"
               << "OpenCL CPU " << std::chrono::duration_cast<std::chrono::milliseconds>(openCLCPUTime).count() << " ms\n"
               << "OpenCL GPU " << std::chrono::duration_cast<std::chrono::milliseconds>(openCLGPUTime).count() << " ms\n"
-              << "OpenMP     " << std::chrono::duration_cast<std::chrono::milliseconds>(ompTime).count() << " ms\n";
+              << "OpenMP     " << std::chrono::duration_cast<std::chrono::milliseconds>(ompTime).count() << " ms\n"
+              << "OpenCL async (incl. transfers) "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(openCLAsyncTime).count() << " ms\n";
+
+    baseline.record("cpu_axpy", cpuTime);
+    baseline.record("opencl_axpy CPU", openCLCPUTime);
+    if (hasGPU) baseline.record("opencl_axpy GPU", openCLGPUTime);
+    baseline.record("omp_axpy", ompTime);
+    baseline.record("omp_dot", ompDotTime);
+    baseline.record("opencl_dot CPU", openCLCPUDotTime);
+    if (hasGPU) baseline.record("opencl_dot GPU", openCLGPUDotTime);
+    baseline.compare(verifier);
+    baseline.save();
+
+    std::cout << "\n" << (verifier.failures() ? "FAILED" : "PASSED") << std::endl;
+
+    return verifier.failures() ? 1 : 0;
+}
+
+
+// Every backend against a double-precision reference on random data, with odd lengths and
+// non-unit strides.
+void verify_axpy(Verifier& verifier) {
+    const size_t sizes[] = {1, 17, 1000003};
+    const size_t strides[][2] = {{1, 1}, {2, 3}};
+    const FPType a = static_cast<FPType>(0.75);
+    const double tolerance = sizeof(FPType) == sizeof(double) ? 1e-12 : 1e-6;
+    const bool hasCPU = deviceAvailable(CL_DEVICE_TYPE_CPU), hasGPU = deviceAvailable(CL_DEVICE_TYPE_GPU);
+
+    AsyncScheduler scheduler(CL_DEVICE_TYPE_CPU);
+    ComputeService service(CL_DEVICE_TYPE_CPU, 2);
+    // Specialize from the first call, so the checks cover the KernelJit kernels too; the generic
+    // ones run in the non-shared variants.
+    service.jit().setHotCalls(1);
+
+    for (const size_t n : sizes) {
+        for (const auto& stride : strides) {
+            const size_t incx = stride[0], incy = stride[1];
+            HostVector<FPType> x(n), yInit(n), y(n);
+            fillRandom(x, 1);
+            fillRandom(yInit, 2);
+
+            std::vector<double> reference(yInit.begin(), yInit.end());
+            for (size_t i = 0; i * incy < n && i * incx < n; ++i)
+                reference[i * incy] += static_cast<double>(a) * x[i * incx];
 
-    delete[] x, y;
+            const std::string suffix = " (n = " + std::to_string(n) + ", incx = " + std::to_string(incx) +
+                                       ", incy = " + std::to_string(incy) + ")";
+            auto run = [&](const std::string& name, const bool available, auto backend) {
+                if (!available) {
+                    verifier.skip(name + suffix, "no device");
+                    return;
+                }
+                y = yInit;
+                backend();
+                verifier.check(name + suffix, maxError(n, y.data(), reference.data()), tolerance);
+            };
 
-    return 0;
+            run("cpu_axpy", true, [&]() { cpu_axpy(n, a, x.data(), incx, y.data(), incy); });
+            run("omp_axpy", true, [&]() { omp_axpy(n, a, x.data(), incx, y.data(), incy); });
+            run("opencl_axpy CPU", hasCPU, [&]() { opencl_axpy(n, a, x.data(), incx, y.data(), incy, CL_DEVICE_TYPE_CPU); });
+            run("opencl_axpy GPU", hasGPU, [&]() { opencl_axpy(n, a, x.data(), incx, y.data(), incy, CL_DEVICE_TYPE_GPU); });
+            run("opencl_axpy_async CPU", hasCPU, [&]() { opencl_axpy_async(scheduler, n, a, x.data(), incx, y.data(), incy).wait(); });
+            run("opencl_axpy_shared CPU", hasCPU, [&]() { opencl_axpy_shared(service, n, a, x.data(), incx, y.data(), incy).wait(); });
+        }
+    }
+}
+
+
+// Reductions against double-precision references, with both accumulation modes. Plain float sums
+// of 10^6 terms lose about n * eps / threads, hence the looser tolerance without Kahan.
+void verify_reductions(Verifier& verifier) {
+    const size_t sizes[] = {1, 17, 1000003};
+    const size_t strides[][2] = {{1, 1}, {2, 3}};
+    const bool single = sizeof(FPType) == sizeof(float);
+    const Accumulation modes[] = {Accumulation::Plain, Accumulation::Kahan};
+    const bool hasCPU = deviceAvailable(CL_DEVICE_TYPE_CPU), hasGPU = deviceAvailable(CL_DEVICE_TYPE_GPU);
+
+    for (const size_t n : sizes) {
+        for (const auto& stride : strides) {
+            const size_t incx = stride[0], incy = stride[1];
+            HostVector<FPType> x(n), y(n);
+            fillRandom(x, 3);
+            fillRandom(y, 4);
+
+            double dot = 0.0, nrm2 = 0.0, asum = 0.0, sum = 0.0;
+            size_t iamax = 0;
+            for (size_t i = 0; i * incx < n && i * incy < n; ++i)
+                dot += static_cast<double>(x[i * incx]) * y[i * incy];
+            for (size_t i = 0; i * incx < n; ++i) {
+                nrm2 += static_cast<double>(x[i * incx]) * x[i * incx];
+                asum += std::fabs(static_cast<double>(x[i * incx]));
+                sum += x[i * incx];
+                if (std::fabs(x[i * incx]) > std::fabs(x[iamax * incx])) iamax = i;
+            }
+            nrm2 = std::sqrt(nrm2);
+
+            const std::string suffix = " (n = " + std::to_string(n) + ", incx = " + std::to_string(incx) +
+                                       ", incy = " + std::to_string(incy) + ")";
+            for (const Accumulation mode : modes) {
+                const bool kahan = mode == Accumulation::Kahan;
+                const double tolerance = single ? (kahan ? 1e-5 : 1e-3) : 1e-12;
+                const std::string tag = kahan ? " Kahan" : "";
+
+                auto check = [&](const std::string& name, const bool available, const double reference, auto backend) {
+                    if (!available) {
+                        verifier.skip(name + tag + suffix, "no device");
+                        return;
+                    }
+                    FPType result = 0;
+                    backend(result);
+                    verifier.check(name + tag + suffix, maxError(1, &result, &reference), tolerance);
+                };
+
+                check("omp_dot", true, dot, [&](FPType& r) { omp_dot(n, x.data(), incx, y.data(), incy, r, mode); });
+                check("omp_nrm2", true, nrm2, [&](FPType& r) { omp_nrm2(n, x.data(), incx, r, mode); });
+                check("omp_asum", true, asum, [&](FPType& r) { omp_asum(n, x.data(), incx, r, mode); });
+                check("omp_sum", true, sum, [&](FPType& r) { omp_sum(n, x.data(), incx, r, mode); });
+                const std::pair<const char*, cl_device_type> devices[] = {{" CPU", CL_DEVICE_TYPE_CPU}, {" GPU", CL_DEVICE_TYPE_GPU}};
+                for (const auto& device : devices) {
+                    const bool available = device.second == CL_DEVICE_TYPE_CPU ? hasCPU : hasGPU;
+                    check(std::string("opencl_dot") + device.first, available, dot,
+                          [&](FPType& r) { opencl_dot(n, x.data(), incx, y.data(), incy, r, device.second, mode); });
+                    check(std::string("opencl_nrm2") + device.first, available, nrm2,
+                          [&](FPType& r) { opencl_nrm2(n, x.data(), incx, r, device.second, mode); });
+                    check(std::string("opencl_asum") + device.first, available, asum,
+                          [&](FPType& r) { opencl_asum(n, x.data(), incx, r, device.second, mode); });
+                    check(std::string("opencl_sum") + device.first, available, sum,
+                          [&](FPType& r) { opencl_sum(n, x.data(), incx, r, device.second, mode); });
+                }
+            }
+
+            size_t index = 0;
+            omp_iamax(n, x.data(), incx, index);
+            verifier.check("omp_iamax" + suffix, index == iamax ? 0.0 : 1.0, 0.0);
+            if (hasCPU) {
+                opencl_iamax(n, x.data(), incx, index, CL_DEVICE_TYPE_CPU);
+                verifier.check("opencl_iamax CPU" + suffix, index == iamax ? 0.0 : 1.0, 0.0);
+            }
+            if (hasGPU) {
+                opencl_iamax(n, x.data(), incx, index, CL_DEVICE_TYPE_GPU);
+                verifier.check("opencl_iamax GPU" + suffix, index == iamax ? 0.0 : 1.0, 0.0);
+            }
+        }
+    }
 }
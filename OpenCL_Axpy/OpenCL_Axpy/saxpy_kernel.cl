@@ -1,5 +1,12 @@
-__kernel void saxpy(const size_t n, const float a, __global const float *x, const size_t incx, __global float *y, const size_t incy) {
+// Built with -D INCX=<incx> -D INCY=<incy> for hot strides (KernelJit), the strides are
+// constants and the host launches exactly the active work-items, so there is no bounds check.
+__kernel void saxpy(const size_t nArg, const float a, __global const float *x, const size_t incxArg, __global float *y, const size_t incyArg) {
     int i = get_global_id(0);
-    if (i < n)
+#ifdef INCX
+    const size_t incx = INCX, incy = INCY;
+#else
+    const size_t n = nArg, incx = incxArg, incy = incyArg;
+    if (i * incy < n && i * incx < n)
+#endif
          y[i * incy] = y[i * incy] + a * x[i * incx];
 }
@@ -0,0 +1,334 @@
+#pragma once
+
+#include <CL/cl.h>
+#include "kernels.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <utility>
+#include <initializer_list>
+
+
+inline void asyncCheck(const cl_int retCode, const char *message) {
+    if (retCode) printf("Error: retCode = %d [%s]\n", static_cast<int>(retCode), message);
+}
+
+
+// Owning handle of a cl_event. An empty event counts as already completed.
+class AsyncEvent {
+public:
+    AsyncEvent() = default;
+    explicit AsyncEvent(cl_event event) : event_(event) {}
+    AsyncEvent(const AsyncEvent& other) : event_(other.event_) { if (event_) clRetainEvent(event_); }
+    AsyncEvent(AsyncEvent&& other) noexcept : event_(other.event_) { other.event_ = nullptr; }
+    AsyncEvent& operator=(AsyncEvent other) { std::swap(event_, other.event_); return *this; }
+    ~AsyncEvent() { if (event_) clReleaseEvent(event_); }
+
+    cl_event get() const { return event_; }
+    bool empty() const { return event_ == nullptr; }
+
+    bool ready() const {
+        if (!event_) return true;
+        cl_int status = CL_COMPLETE;
+        clGetEventInfo(event_, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(cl_int), &status, nullptr);
+        return status <= CL_COMPLETE;
+    }
+
+    void wait() const {
+        if (event_) asyncCheck(clWaitForEvents(1, &event_), "clWaitForEvents");
+    }
+
+private:
+    cl_event event_ = nullptr;
+};
+
+
+inline void waitAll(const std::vector<AsyncEvent>& events) {
+    std::vector<cl_event> handles;
+    for (const auto& event : events)
+        if (!event.empty()) handles.push_back(event.get());
+    if (!handles.empty())
+        asyncCheck(clWaitForEvents(static_cast<cl_uint>(handles.size()), handles.data()), "clWaitForEvents");
+}
+
+
+// Context on the first platform holding the first device of the requested type, as the labs do.
+inline cl_int createDeviceContext(cl_device_type deviceType, cl_context& context, cl_device_id& device) {
+    cl_int retCode = 0;
+    cl_uint platformsCount = 0;
+    clGetPlatformIDs(0, nullptr, &platformsCount);
+    std::vector<cl_platform_id> platforms(platformsCount);
+    clGetPlatformIDs(platformsCount, platforms.data(), nullptr);
+
+    cl_platform_id platform = platformsCount ? platforms[0] : nullptr;
+    cl_context_properties properties[3] = {
+        CL_CONTEXT_PLATFORM,
+        (cl_context_properties)platform,
+        0
+    };
+
+    context = clCreateContextFromType((platform == nullptr) ? nullptr : properties, deviceType, 0, 0, &retCode);
+    asyncCheck(retCode, "clCreateContextFromType");
+    if (retCode) {
+        context = nullptr;
+        return retCode;
+    }
+
+    size_t devicesSize = 0;
+    clGetContextInfo(context, CL_CONTEXT_DEVICES, 0, nullptr, &devicesSize);
+    std::vector<cl_device_id> devices(devicesSize / sizeof(cl_device_id));
+    clGetContextInfo(context, CL_CONTEXT_DEVICES, devicesSize, devices.data(), nullptr);
+    device = devices[0];
+
+    return CL_SUCCESS;
+}
+
+
+// Builds a kernel file (embedded or on disk, see kernelSource) for one device, printing the build
+// log on failure.
+inline cl_program buildProgram(cl_context context, cl_device_id device, const char *filename, const char *options = nullptr) {
+    cl_int retCode = 0;
+    const std::string content = kernelSource(filename);
+    const char *source = content.c_str();
+    size_t sourceLen = content.length();
+
+    cl_program program = clCreateProgramWithSource(context, 1, &source, &sourceLen, &retCode);
+    asyncCheck(retCode, "clCreateProgramWithSource");
+    retCode = clBuildProgram(program, 1, &device, options, 0, 0);
+    if (retCode != CL_SUCCESS) {
+        size_t logSize = 0;
+        clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, nullptr, &logSize);
+        std::string log(logSize, '\0');
+        clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, logSize, &log[0], nullptr);
+        printf("\n-------------------------------------\n");
+        printf("log:\n%s", log.c_str());
+        printf("-------------------------------------\n\n");
+    }
+
+    return program;
+}
+
+
+// Device buffer that remembers the last command writing it and the commands reading it since,
+// which is what AsyncScheduler derives the RAW/WAR/WAW edges of the dependency DAG from.
+// Releasing it while commands are still queued is fine: the runtime defers the deletion.
+class AsyncBuffer {
+public:
+    AsyncBuffer() = default;
+    AsyncBuffer(cl_mem mem, size_t size) : mem_(mem), size_(size) {}
+    AsyncBuffer(const AsyncBuffer&) = delete;
+    AsyncBuffer& operator=(const AsyncBuffer&) = delete;
+    AsyncBuffer(AsyncBuffer&& other) noexcept { swap(other); }
+    AsyncBuffer& operator=(AsyncBuffer&& other) noexcept { swap(other); return *this; }
+    ~AsyncBuffer() { if (mem_) clReleaseMemObject(mem_); }
+
+    cl_mem mem() const { return mem_; }
+    const cl_mem *memPtr() const { return &mem_; }
+    size_t size() const { return size_; }
+
+private:
+    friend class AsyncScheduler;
+
+    void swap(AsyncBuffer& other) {
+        std::swap(mem_, other.mem_);
+        std::swap(size_, other.size_);
+        std::swap(lastWrite_, other.lastWrite_);
+        std::swap(reads_, other.reads_);
+    }
+
+    cl_mem mem_ = nullptr;
+    size_t size_ = 0;
+    AsyncEvent lastWrite_;
+    std::vector<AsyncEvent> reads_;
+};
+
+
+// Context, device and command queues of one device type. Commands go to a single out-of-order
+// queue when the device supports it and are spread round-robin over several in-order queues
+// otherwise; in both cases ordering comes only from the event wait lists, so independent
+// transfers and kernels overlap and the host blocks only in AsyncEvent::wait. Without a device
+// of the type the scheduler is not valid(): nothing is built and every enqueue returns an empty
+// event, so callers should check valid() (or deviceAvailable) before relying on the results.
+class AsyncScheduler {
+public:
+    explicit AsyncScheduler(cl_device_type deviceType, const cl_uint inOrderQueues = 4) {
+        cl_int retCode = createDeviceContext(deviceType, context_, device_);
+        if (retCode) return;
+
+        cl_command_queue_properties supported = 0;
+        clGetDeviceInfo(device_, CL_DEVICE_QUEUE_ON_HOST_PROPERTIES, sizeof(supported), &supported, nullptr);
+        outOfOrder_ = (supported & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) != 0;
+
+        const cl_queue_properties queueProperties[] = {
+            CL_QUEUE_PROPERTIES, CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE, 0
+        };
+        const cl_uint queuesCount = outOfOrder_ ? 1 : std::max(inOrderQueues, 1u);
+        for (cl_uint i = 0; i < queuesCount; ++i) {
+            cl_command_queue queue = clCreateCommandQueueWithProperties(context_, device_,
+                outOfOrder_ ? queueProperties : nullptr, &retCode);
+            asyncCheck(retCode, "clCreateCommandQueueWithProperties");
+            if (!retCode) queues_.push_back(queue);
+        }
+    }
+
+    AsyncScheduler(const AsyncScheduler&) = delete;
+    AsyncScheduler& operator=(const AsyncScheduler&) = delete;
+
+    ~AsyncScheduler() {
+        finish();
+        for (auto& entry : kernels_) {
+            clReleaseKernel(entry.second.second);
+            clReleaseProgram(entry.second.first);
+        }
+        for (auto queue : queues_)
+            clReleaseCommandQueue(queue);
+        if (context_) clReleaseContext(context_);
+    }
+
+    bool valid() const { return context_ != nullptr && !queues_.empty(); }
+    bool outOfOrder() const { return outOfOrder_; }
+    cl_context context() const { return context_; }
+    cl_device_id device() const { return device_; }
+
+    // Builds the program on first use and keeps it for the scheduler's lifetime. Kernel arguments
+    // are captured at enqueue time, so the same kernel can be relaunched before earlier runs finish.
+    cl_kernel kernel(const char *filename, const char *kernelName, const char *options = nullptr) {
+        std::string key = std::string(filename) + ':' + kernelName + ':' + (options ? options : "");
+        auto it = kernels_.find(key);
+        if (it != kernels_.end()) return it->second.second;
+        if (!valid()) return nullptr;
+
+        cl_int retCode = 0;
+        cl_program program = buildProgram(context_, device_, filename, options);
+        cl_kernel kernel = clCreateKernel(program, kernelName, &retCode);
+        asyncCheck(retCode, "clCreateKernel");
+        kernels_[key] = std::make_pair(program, kernel);
+
+        return kernel;
+    }
+
+    AsyncBuffer createBuffer(const cl_mem_flags flags, const size_t size) {
+        if (!valid()) return AsyncBuffer();
+
+        cl_int retCode = 0;
+        cl_mem mem = clCreateBuffer(context_, flags, size, 0, &retCode);
+        asyncCheck(retCode, "clCreateBuffer");
+
+        return AsyncBuffer(mem, size);
+    }
+
+    // src must stay valid until the returned event completes.
+    AsyncEvent write(AsyncBuffer& buffer, const void *src, const size_t size,
+                     const std::vector<AsyncEvent>& deps = {}) {
+        if (!valid()) return AsyncEvent();
+
+        std::vector<AsyncEvent> waitList = deps;
+        addWriteDeps(buffer, waitList);
+        std::vector<cl_event> handles = eventHandles(waitList);
+
+        cl_event event = nullptr;
+        cl_command_queue queue = nextQueue();
+        asyncCheck(clEnqueueWriteBuffer(queue, buffer.mem_, CL_FALSE, 0, size, src,
+            static_cast<cl_uint>(handles.size()), handles.empty() ? nullptr : handles.data(), &event), "clEnqueueWriteBuffer");
+        clFlush(queue);
+
+        AsyncEvent result(event);
+        recordWrite(buffer, result);
+        return result;
+    }
+
+    // dst must not be touched by the host until the returned event completes.
+    AsyncEvent read(AsyncBuffer& buffer, void *dst, const size_t size,
+                    const std::vector<AsyncEvent>& deps = {}) {
+        if (!valid()) return AsyncEvent();
+
+        std::vector<AsyncEvent> waitList = deps;
+        addReadDeps(buffer, waitList);
+        std::vector<cl_event> handles = eventHandles(waitList);
+
+        cl_event event = nullptr;
+        cl_command_queue queue = nextQueue();
+        asyncCheck(clEnqueueReadBuffer(queue, buffer.mem_, CL_FALSE, 0, size, dst,
+            static_cast<cl_uint>(handles.size()), handles.empty() ? nullptr : handles.data(), &event), "clEnqueueReadBuffer");
+        clFlush(queue);
+
+        AsyncEvent result(event);
+        recordRead(buffer, result);
+        return result;
+    }
+
+    // The kernel arguments must already be set; reads/writes list the buffers bound to them.
+    AsyncEvent launch(cl_kernel kernel, const cl_uint workDim, const size_t *globalSize, const size_t *localSize,
+                      std::initializer_list<AsyncBuffer*> reads, std::initializer_list<AsyncBuffer*> writes,
+                      const std::vector<AsyncEvent>& deps = {}) {
+        if (!valid()) return AsyncEvent();
+
+        std::vector<AsyncEvent> waitList = deps;
+        for (auto buffer : reads)  addReadDeps(*buffer, waitList);
+        for (auto buffer : writes) addWriteDeps(*buffer, waitList);
+        std::vector<cl_event> handles = eventHandles(waitList);
+
+        cl_event event = nullptr;
+        cl_command_queue queue = nextQueue();
+        asyncCheck(clEnqueueNDRangeKernel(queue, kernel, workDim, 0, globalSize, localSize,
+            static_cast<cl_uint>(handles.size()), handles.empty() ? nullptr : handles.data(), &event), "clEnqueueNDRangeKernel");
+        clFlush(queue);
+
+        AsyncEvent result(event);
+        for (auto buffer : reads)  recordRead(*buffer, result);
+        for (auto buffer : writes) recordWrite(*buffer, result);
+        return result;
+    }
+
+    void finish() {
+        for (auto queue : queues_)
+            clFinish(queue);
+    }
+
+private:
+    cl_command_queue nextQueue() {
+        cl_command_queue queue = queues_[nextQueue_];
+        nextQueue_ = (nextQueue_ + 1) % queues_.size();
+        return queue;
+    }
+
+    static std::vector<cl_event> eventHandles(const std::vector<AsyncEvent>& events) {
+        std::vector<cl_event> handles;
+        for (const auto& event : events)
+            if (!event.empty()) handles.push_back(event.get());
+        return handles;
+    }
+
+    static void addReadDeps(const AsyncBuffer& buffer, std::vector<AsyncEvent>& waitList) {
+        waitList.push_back(buffer.lastWrite_);
+    }
+
+    static void addWriteDeps(const AsyncBuffer& buffer, std::vector<AsyncEvent>& waitList) {
+        waitList.push_back(buffer.lastWrite_);
+        waitList.insert(waitList.end(), buffer.reads_.begin(), buffer.reads_.end());
+    }
+
+    static void recordRead(AsyncBuffer& buffer, const AsyncEvent& event) {
+        if (buffer.reads_.size() >= 16) {
+            std::vector<AsyncEvent> pending;
+            for (auto& read : buffer.reads_)
+                if (!read.ready()) pending.push_back(std::move(read));
+            buffer.reads_.swap(pending);
+        }
+        buffer.reads_.push_back(event);
+    }
+
+    static void recordWrite(AsyncBuffer& buffer, const AsyncEvent& event) {
+        buffer.lastWrite_ = event;
+        buffer.reads_.clear();
+    }
+
+    cl_context context_ = nullptr;
+    cl_device_id device_ = nullptr;
+    std::vector<cl_command_queue> queues_;
+    size_t nextQueue_ = 0;
+    bool outOfOrder_ = false;
+    std::map<std::string, std::pair<cl_program, cl_kernel>> kernels_;
+};
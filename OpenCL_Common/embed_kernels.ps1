@@ -0,0 +1,43 @@
+# Pre-build step of the lab projects: embeds the OpenCL kernel sources in the executable.
+#
+#   embed_kernels.ps1 -Output <header> -Directories "<dir>;<dir>"
+#
+# Every *.cl file of the directories becomes a raw string literal registered under its file name
+# with EmbeddedKernel (kernels.h). The header is only rewritten when its content changes, so an
+# unchanged kernel does not trigger a rebuild.
+param(
+    [Parameter(Mandatory = $true)][string]$Output,
+    [Parameter(Mandatory = $true)][string]$Directories
+)
+
+$ErrorActionPreference = 'Stop'
+
+# MSVC limits a single string literal to 16 KB, so longer sources are split into adjacent literals.
+$chunkLength = 8192
+$delimiter = 'CLSRC'
+
+$files = $Directories -split ';' | Where-Object { $_ } |
+    ForEach-Object { Get-ChildItem -Path $_ -Filter *.cl -File } | Sort-Object Name
+
+$text = New-Object System.Text.StringBuilder
+[void]$text.Append("// Generated from the .cl files by OpenCL_Common/embed_kernels.ps1, do not edit.`n")
+[void]$text.Append("#pragma once`n`n#include `"../../OpenCL_Common/kernels.h`"`n")
+
+foreach ($file in $files) {
+    $source = [System.IO.File]::ReadAllText($file.FullName) -replace "`r`n", "`n"
+    if ($source.Contains(")$delimiter`"")) { throw "$($file.Name) contains the raw string delimiter" }
+
+    $name = [System.IO.Path]::GetFileNameWithoutExtension($file.Name) -replace '[^A-Za-z0-9_]', '_'
+    [void]$text.Append("`nstatic const EmbeddedKernel ${name}_embedded(`"$($file.Name)`",`n")
+    if ($source.Length -eq 0) { [void]$text.Append("    `"`"`n") }
+    for ($i = 0; $i -lt $source.Length; $i += $chunkLength) {
+        $chunk = $source.Substring($i, [Math]::Min($chunkLength, $source.Length - $i))
+        [void]$text.Append("    R`"$delimiter($chunk)$delimiter`"`n")
+    }
+    [void]$text.Append(");`n")
+}
+
+$content = $text.ToString()
+if (-not (Test-Path $Output) -or [System.IO.File]::ReadAllText($Output) -ne $content) {
+    [System.IO.File]::WriteAllText($Output, $content)
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <initializer_list>
+
+
+// Shape specialization for kernels called again and again with the same sizes. The first calls
+// of a shape run the generic kernel; once a shape has been requested hotCalls times its kernel is
+// rebuilt with the shape as -D constants (-D N=4096 -D INCX=1 ...), so the compiler sees constant
+// trip counts to unroll and the kernels drop the bounds checks the shape makes redundant.
+// ComputeService caches programs by (file, options), which makes its program map the cache of
+// specialized programs by shape. A specialization that fails to build is not tried again.
+class KernelJit {
+public:
+    explicit KernelJit(const unsigned hotCalls = 3) : hotCalls_(hotCalls) {}
+
+    KernelJit(const KernelJit&) = delete;
+    KernelJit& operator=(const KernelJit&) = delete;
+
+    // Build options for this call of `kernel` with `shape`: the shape once it is hot, else empty
+    // for the generic kernel. Thread-safe.
+    std::string options(const std::string& kernel, const std::string& shape) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const std::string key = kernel + ':' + shape;
+        if (rejected_.count(key)) return std::string();
+
+        return ++calls_[key] >= hotCalls_ ? shape : std::string();
+    }
+
+    void reject(const std::string& kernel, const std::string& shape) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (rejected_.insert(kernel + ':' + shape).second)
+            printf("Warning: %s failed to build with \"%s\", using the generic kernel\n", kernel.c_str(), shape.c_str());
+    }
+
+    // 1 specializes from the first call.
+    void setHotCalls(const unsigned hotCalls) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        hotCalls_ = hotCalls;
+    }
+
+private:
+    std::mutex mutex_;
+    unsigned hotCalls_;
+    std::map<std::string, unsigned> calls_;
+    std::set<std::string> rejected_;
+};
+
+
+// "-D N=1024 -D INCX=1": shape constants as build options.
+inline std::string shapeOptions(std::initializer_list<std::pair<const char*, size_t>> constants) {
+    std::string options;
+    for (const auto& constant : constants) {
+        if (!options.empty()) options += ' ';
+        options += std::string("-D ") + constant.first + '=' + std::to_string(constant.second);
+    }
+
+    return options;
+}
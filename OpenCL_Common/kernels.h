@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <string>
+
+
+// Kernel sources compiled into the executable, so the labs run from any working directory. The
+// projects' pre-build step runs embed_kernels.ps1 over their .cl files and OpenCL_Common's and
+// generates embedded_kernels.h, whose static EmbeddedKernel objects fill this table before main.
+// The .cl files remain the sources to edit.
+inline std::map<std::string, const char*>& embeddedKernels() {
+    static std::map<std::string, const char*> kernels;
+    return kernels;
+}
+
+struct EmbeddedKernel {
+    EmbeddedKernel(const char *filename, const char *source) {
+        embeddedKernels()[filename] = source;
+    }
+};
+
+
+// Source of a kernel file: the embedded copy, looked up by the file name without directories, or
+// else the file relative to the working directory. Prints an error and returns an empty string
+// when there is neither, rather than letting the caller build an empty program.
+inline std::string kernelSource(const char *filename) {
+    const std::string path(filename);
+    const size_t slash = path.find_last_of("/\\");
+    auto it = embeddedKernels().find(slash == std::string::npos ? path : path.substr(slash + 1));
+    if (it != embeddedKernels().end()) return it->second;
+
+    std::ifstream ifs(filename);
+    std::string content{ std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>() };
+    if (content.empty()) printf("Error: kernel source %s is neither embedded nor readable\n", filename);
+
+    return content;
+}
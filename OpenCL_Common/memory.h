@@ -0,0 +1,221 @@
+#pragma once
+
+#include "numa.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <vector>
+#include <type_traits>
+#include <algorithm>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+
+// Host memory for the labs' vectors and matrices: cache-line or page aligned, and on Linux backed
+// by 2 MB pages for large arrays, which cuts the TLB misses of 400 MB sweeps by a factor of 512.
+// Transparent asks the kernel through madvise(MADV_HUGEPAGE); Explicit maps from the reserved
+// hugetlbfs pool (vm.nr_hugepages) and falls back to Transparent when the pool is empty.
+// Huge pages and interleaving are ignored elsewhere.
+enum class HugePages { None, Transparent, Explicit };
+
+struct HostMemory {
+    size_t alignment;
+    HugePages hugePages;
+    NumaPlacement placement;
+};
+
+// Defaults of the labs' large arrays: 4 KB alignment, as runtimes require for zero-copy
+// CL_MEM_USE_HOST_PTR buffers, and transparent huge pages.
+inline HostMemory hostMemory(const size_t alignment = 4096, const HugePages hugePages = HugePages::Transparent,
+                             const NumaPlacement placement = NumaPlacement::FirstTouch) {
+    return {alignment, hugePages, placement};
+}
+
+
+const size_t hugePageSize = size_t(2) << 20;
+
+
+#ifdef __linux__
+// Large or interleaved arrays are mapped directly, everything else comes from posix_memalign.
+// Alignments above a page are only honoured by posix_memalign.
+inline bool hostMapped(const size_t bytes, const HostMemory& memory) {
+    if (memory.alignment > 4096) return false;
+    return memory.placement == NumaPlacement::Interleave || (memory.hugePages != HugePages::None && bytes >= hugePageSize);
+}
+
+inline size_t mappedLength(const size_t bytes, const HostMemory& memory) {
+    const size_t granule = memory.hugePages == HugePages::None ? size_t(4096) : hugePageSize;
+    return (bytes + granule - 1) / granule * granule;
+}
+#endif
+
+
+// Throws std::bad_alloc like operator new. Release with hostRelease and the same size and options.
+inline void *hostAllocate(const size_t bytes, const HostMemory& memory) {
+    if (bytes == 0) return nullptr;
+
+#ifdef __linux__
+    if (hostMapped(bytes, memory)) {
+        const size_t length = mappedLength(bytes, memory);
+        void *data = MAP_FAILED;
+        if (memory.hugePages == HugePages::Explicit) {
+            data = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            static bool warned = false;
+            if (data == MAP_FAILED && !warned) {
+                printf("Warning: MAP_HUGETLB failed (vm.nr_hugepages too small?), using transparent huge pages\n");
+                warned = true;
+            }
+        }
+
+        if (data == MAP_FAILED) {
+            // Map a window one huge page larger and trim it to a 2 MB-aligned range, so that the
+            // kernel can back all of it with huge pages.
+            const size_t slack = memory.hugePages == HugePages::None ? 0 : hugePageSize;
+            char *raw = static_cast<char*>(mmap(nullptr, length + slack, PROT_READ | PROT_WRITE,
+                                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+            if (raw == MAP_FAILED) throw std::bad_alloc();
+
+            char *aligned = raw;
+            if (slack) {
+                aligned = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(raw) + slack - 1) / slack * slack);
+                if (aligned > raw) munmap(raw, aligned - raw);
+                if (raw + slack > aligned) munmap(aligned + length, raw + slack - aligned);
+                madvise(aligned, length, MADV_HUGEPAGE);
+            }
+            data = aligned;
+        }
+
+        if (memory.placement == NumaPlacement::Interleave)
+            numaInterleave(data, length);
+
+        return data;
+    }
+#endif
+
+    void *data = nullptr;
+#ifdef _WIN32
+    data = _aligned_malloc(bytes, std::max(memory.alignment, sizeof(void*)));
+#else
+    if (posix_memalign(&data, std::max(memory.alignment, sizeof(void*)), bytes)) data = nullptr;
+#endif
+    if (!data) throw std::bad_alloc();
+
+    return data;
+}
+
+inline void hostRelease(void *data, const size_t bytes, const HostMemory& memory) {
+    if (!data) return;
+
+#ifdef __linux__
+    if (hostMapped(bytes, memory)) {
+        munmap(data, mappedLength(bytes, memory));
+        return;
+    }
+#else
+    (void)bytes;
+    (void)memory;
+#endif
+
+#ifdef _WIN32
+    _aligned_free(data);
+#else
+    std::free(data);
+#endif
+}
+
+
+// STL allocator over hostAllocate, cache-line aligned by default.
+template <typename T, size_t Alignment = 64, HugePages Huge = HugePages::None>
+class AlignedAllocator {
+public:
+    using value_type = T;
+
+    template <typename U>
+    struct rebind {
+        using other = AlignedAllocator<U, Alignment, Huge>;
+    };
+
+    AlignedAllocator() = default;
+
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment, Huge>&) {}
+
+    T *allocate(const size_t count) {
+        return static_cast<T*>(hostAllocate(sizeof(T) * count, memory()));
+    }
+
+    void deallocate(T *data, const size_t count) {
+        hostRelease(data, sizeof(T) * count, memory());
+    }
+
+    static HostMemory memory() {
+        return hostMemory(Alignment, Huge);
+    }
+};
+
+template <typename T, typename U, size_t Alignment, HugePages Huge>
+bool operator==(const AlignedAllocator<T, Alignment, Huge>&, const AlignedAllocator<U, Alignment, Huge>&) {
+    return true;
+}
+
+template <typename T, typename U, size_t Alignment, HugePages Huge>
+bool operator!=(const AlignedAllocator<T, Alignment, Huge>&, const AlignedAllocator<U, Alignment, Huge>&) {
+    return false;
+}
+
+
+// std::vector with the defaults of the labs' large arrays.
+template <typename T>
+using HostVector = std::vector<T, AlignedAllocator<T, 4096, HugePages::Transparent>>;
+
+
+// Owning array of trivial elements. Unlike std::vector it does not initialize them, so the pages
+// are still untouched for firstTouch (mapped memory reads as zero until written).
+template <typename T>
+class HostBuffer {
+    static_assert(std::is_trivial<T>::value, "HostBuffer holds trivial element types only");
+
+public:
+    HostBuffer() = default;
+
+    explicit HostBuffer(const size_t count, const HostMemory& memory = hostMemory())
+        : data_(static_cast<T*>(hostAllocate(sizeof(T) * count, memory))), count_(count), memory_(memory) {}
+
+    HostBuffer(const HostBuffer&) = delete;
+    HostBuffer& operator=(const HostBuffer&) = delete;
+    HostBuffer(HostBuffer&& other) noexcept { swap(other); }
+    HostBuffer& operator=(HostBuffer&& other) noexcept { swap(other); return *this; }
+    ~HostBuffer() { hostRelease(data_, sizeof(T) * count_, memory_); }
+
+    T *data() { return data_; }
+    const T *data() const { return data_; }
+    size_t size() const { return count_; }
+
+    T& operator[](const size_t i) { return data_[i]; }
+    const T& operator[](const size_t i) const { return data_[i]; }
+
+    T *begin() { return data_; }
+    T *end() { return data_ + count_; }
+    const T *begin() const { return data_; }
+    const T *end() const { return data_ + count_; }
+
+private:
+    void swap(HostBuffer& other) {
+        std::swap(data_, other.data_);
+        std::swap(count_, other.count_);
+        std::swap(memory_, other.memory_);
+    }
+
+    T *data_ = nullptr;
+    size_t count_ = 0;
+    HostMemory memory_ = hostMemory();
+};
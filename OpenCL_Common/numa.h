@@ -0,0 +1,113 @@
+#pragma once
+
+#include <omp.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+// Page placement on multi-socket machines. Linux places a page on the node of the thread that
+// first writes it, so data initialized by a serial loop ends up on one node and the other
+// socket's threads read it remotely. The helpers here touch pages from the threads that later
+// compute on them, or spread pages over all nodes round-robin.
+enum class NumaPlacement { FirstTouch, Interleave };
+
+
+// Zeroes `rows` rows of `rowLength` elements from the OpenMP team with schedule(static) over rows,
+// which is how omp_axpy (rowLength 1), omp_gemm and omp_jacobi partition their loops, so each
+// thread's pages land on its own node. Values may then be filled serially: placement is fixed.
+template <typename T>
+void firstTouch(T *data, const size_t rows, const size_t rowLength = 1) {
+    const int m = static_cast<int>(rows);
+    int i;
+#pragma omp parallel for schedule(static) private(i)
+    for (i = 0; i < m; ++i)
+        std::memset(data + static_cast<size_t>(i) * rowLength, 0, sizeof(T) * rowLength);
+}
+
+
+#ifdef __linux__
+// Nodes with memory, from /sys (e.g. "0-1" or "0,2-3"), as an mbind node mask.
+inline std::vector<unsigned long> onlineNodeMask() {
+    std::ifstream ifs("/sys/devices/system/node/online");
+    std::string list;
+    std::getline(ifs, list);
+    if (list.empty()) list = "0";
+
+    std::vector<unsigned long> mask(1, 0);
+    const size_t bits = 8 * sizeof(unsigned long);
+    size_t pos = 0;
+    while (pos < list.size()) {
+        char *end = nullptr;
+        const unsigned long first = std::strtoul(list.c_str() + pos, &end, 10);
+        unsigned long last = first;
+        if (*end == '-') last = std::strtoul(end + 1, &end, 10);
+        for (unsigned long node = first; node <= last; ++node) {
+            if (node / bits >= mask.size()) mask.resize(node / bits + 1, 0);
+            mask[node / bits] |= 1ul << (node % bits);
+        }
+        pos = end - list.c_str() + 1;
+    }
+
+    return mask;
+}
+#endif
+
+
+// Spreads the pages of a mapped, untouched range round-robin over all online nodes (Linux only).
+// hostAllocate in memory.h does this for NumaPlacement::Interleave.
+inline bool numaInterleave(void *data, const size_t bytes) {
+#ifdef __linux__
+    const int mpolInterleave = 3;  // MPOL_INTERLEAVE from <linux/mempolicy.h>
+    std::vector<unsigned long> mask = onlineNodeMask();
+    if (syscall(SYS_mbind, data, bytes, mpolInterleave, mask.data(), 8 * sizeof(unsigned long) * mask.size() + 1, 0) == 0)
+        return true;
+    printf("Warning: mbind(MPOL_INTERLEAVE) failed, using first-touch placement\n");
+#else
+    (void)data;
+    (void)bytes;
+#endif
+    return false;
+}
+
+
+// First-touch placement only sticks if threads stay on their node. Unless the user set them,
+// asks the OpenMP runtime for OMP_PROC_BIND=close and OMP_PLACES=cores; the runtime reads them
+// once, so call this before the first OpenMP construct.
+inline void requestThreadBinding() {
+#ifdef _WIN32
+    if (!std::getenv("OMP_PROC_BIND")) _putenv_s("OMP_PROC_BIND", "close");
+    if (!std::getenv("OMP_PLACES")) _putenv_s("OMP_PLACES", "cores");
+#else
+    setenv("OMP_PROC_BIND", "close", 0);
+    setenv("OMP_PLACES", "cores", 0);
+#endif
+}
+
+// Prints the binding settings and, on Linux, the CPU and node each OpenMP thread runs on.
+inline void printThreadPlacement() {
+    const char *bind = std::getenv("OMP_PROC_BIND"), *places = std::getenv("OMP_PLACES");
+    printf("OMP_PROC_BIND=%s OMP_PLACES=%s, %d threads\n", bind ? bind : "(unset)", places ? places : "(unset)",
+           omp_get_max_threads());
+#ifdef __linux__
+    std::vector<unsigned> cpus(omp_get_max_threads()), nodes(omp_get_max_threads());
+#pragma omp parallel
+    {
+        unsigned cpu = 0, node = 0;
+        syscall(SYS_getcpu, &cpu, &node, nullptr);
+        cpus[omp_get_thread_num()] = cpu;
+        nodes[omp_get_thread_num()] = node;
+    }
+    for (size_t t = 0; t < cpus.size(); ++t)
+        printf("%sthread %zu: cpu %u node %u", t ? ", " : "", t, cpus[t], nodes[t]);
+    printf("\n");
+#endif
+}
@@ -0,0 +1,183 @@
+#pragma once
+
+#include <cstdio>
+#include <chrono>
+#include <algorithm>
+
+// Hardware counters for the host kernels through Linux perf_event_open. Compiled in only when
+// OPENCL_LABS_PERF is defined on Linux; otherwise measureCounters just calls the kernel.
+#if defined(OPENCL_LABS_PERF) && defined(__linux__)
+#define OPENCL_LABS_PERF_ENABLED 1
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <omp.h>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#endif
+
+
+#ifdef OPENCL_LABS_PERF_ENABLED
+
+enum PerfEvent { PerfCycles, PerfInstructions, PerfL1DMisses, PerfLLCMisses, PerfDTLBMisses, PerfEventCount };
+
+
+// Counts summed over all threads; an event the PMU or perf_event_paranoid refuses is not valid.
+struct PerfSample {
+    double values[PerfEventCount] = {};
+    bool valid[PerfEventCount] = {};
+};
+
+
+// One set of counters per OpenMP thread, opened and read from inside parallel regions, since a
+// perf event only follows the thread that opened it and the OpenMP pool already exists by the time
+// a kernel is measured. The kernel must run on the same team (the default omp_get_max_threads()).
+// Counters are user-space only and scaled by enabled/running time when the PMU multiplexes them.
+class PerfCounters {
+public:
+    PerfCounters() : fds_(static_cast<size_t>(omp_get_max_threads()) * PerfEventCount, -1),
+                     values_(fds_.size(), -1.0) {}
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    ~PerfCounters() {
+        for (int fd : fds_)
+            if (fd >= 0) close(fd);
+    }
+
+    void start() {
+#pragma omp parallel
+        {
+            int *fds = &fds_[static_cast<size_t>(omp_get_thread_num()) * PerfEventCount];
+            for (int e = 0; e < PerfEventCount; ++e) {
+                perf_event_attr attr;
+                configure(static_cast<PerfEvent>(e), attr);
+                fds[e] = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+            }
+            for (int e = 0; e < PerfEventCount; ++e) {
+                if (fds[e] < 0) continue;
+                ioctl(fds[e], PERF_EVENT_IOC_RESET, 0);
+                ioctl(fds[e], PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+    }
+
+    PerfSample stop() {
+#pragma omp parallel
+        {
+            const size_t base = static_cast<size_t>(omp_get_thread_num()) * PerfEventCount;
+            for (int e = 0; e < PerfEventCount; ++e) {
+                const int fd = fds_[base + e];
+                if (fd < 0) continue;
+                ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+
+                uint64_t data[3] = {};  // value, time enabled, time running
+                if (read(fd, data, sizeof(data)) == static_cast<ssize_t>(sizeof(data)) && data[2] > 0)
+                    values_[base + e] = static_cast<double>(data[0]) * data[1] / data[2];
+                close(fd);
+                fds_[base + e] = -1;
+            }
+        }
+
+        PerfSample sample;
+        const size_t threads = fds_.size() / PerfEventCount;
+        for (size_t t = 0; t < threads; ++t) {
+            for (int e = 0; e < PerfEventCount; ++e) {
+                const double value = values_[t * PerfEventCount + e];
+                if (value < 0.0) continue;
+                sample.values[e] += value;
+                sample.valid[e] = true;
+            }
+        }
+
+        return sample;
+    }
+
+private:
+    static void configure(const PerfEvent event, perf_event_attr& attr) {
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        const uint64_t readMiss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        switch (event) {
+        case PerfCycles:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case PerfInstructions:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case PerfL1DMisses:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_L1D | readMiss;
+            break;
+        case PerfLLCMisses:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_LL | readMiss;
+            break;
+        default:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_DTLB | readMiss;
+            break;
+        }
+    }
+
+    std::vector<int> fds_;
+    std::vector<double> values_;  // -1 where the event could not be opened or read
+};
+
+
+inline void printCounter(const char *label, const PerfSample& sample, const PerfEvent event) {
+    if (sample.valid[event]) printf("%s %.3g, ", label, sample.values[event]);
+    else printf("%s n/a, ", label);
+}
+
+// One line per call. FLOP/byte is given twice: against the nominal traffic the caller passes
+// (each operand moved once) and against the DRAM traffic implied by LLC misses of 64-byte lines.
+inline void printCounters(const char *name, const double flops, const double bytes, const double seconds,
+                          const PerfSample& sample) {
+    printf("[perf] %s: ", name);
+    printCounter("cycles", sample, PerfCycles);
+    printCounter("instructions", sample, PerfInstructions);
+    if (sample.valid[PerfCycles] && sample.valid[PerfInstructions])
+        printf("IPC %.2f, ", sample.values[PerfInstructions] / sample.values[PerfCycles]);
+    printCounter("L1D misses", sample, PerfL1DMisses);
+    printCounter("LLC misses", sample, PerfLLCMisses);
+    printCounter("dTLB misses", sample, PerfDTLBMisses);
+    printf("%.2f GFLOP/s, FLOP/byte %.3g nominal", flops / std::max(seconds, 1e-9) / 1e9, flops / bytes);
+    if (sample.valid[PerfLLCMisses])
+        printf(" / %.3g from LLC misses", flops / (64.0 * sample.values[PerfLLCMisses]));
+    printf("\n");
+}
+
+#endif
+
+
+// Runs a host kernel returning its steady_clock duration and, with OPENCL_LABS_PERF, prints its
+// hardware counters. flops and bytes are the nominal work and traffic of the call.
+template <typename Function>
+auto measureCounters(const char *name, const double flops, const double bytes, Function function) -> decltype(function()) {
+#ifdef OPENCL_LABS_PERF_ENABLED
+    PerfCounters counters;
+    counters.start();
+    auto time = function();
+    const PerfSample sample = counters.stop();
+    printCounters(name, flops, bytes, std::chrono::duration<double>(time).count(), sample);
+
+    return time;
+#else
+    (void)name;
+    (void)flops;
+    (void)bytes;
+
+    return function();
+#endif
+}
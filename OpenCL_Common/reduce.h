@@ -0,0 +1,411 @@
+#pragma once
+
+#include "async.h"
+
+#include <omp.h>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+
+// Kernel file path relative to the lab's working directory.
+#ifndef REDUCE_KERNEL_FILE
+#define REDUCE_KERNEL_FILE "../../OpenCL_Common/reduce_kernel.cl"
+#endif
+
+
+// How the running sums are formed. Partials of threads and work-groups are always combined by
+// pairwise trees; Kahan additionally compensates the long serial run of each thread or work-item.
+enum class Accumulation { Plain, Kahan };
+
+
+// Vectors follow axpy.h: x holds n values and the reduction runs over x[0], x[incx], ... below n.
+inline size_t stridedCount(const size_t n, const size_t inc) {
+    return (n + inc - 1) / inc;
+}
+
+
+template <typename FPType>
+struct KahanSum {
+    FPType sum = 0, compensation = 0;
+
+    void add(const FPType value) {
+        const FPType y = value - compensation;
+        const FPType t = sum + y;
+        compensation = (t - sum) - y;
+        sum = t;
+    }
+
+    FPType result() const { return sum - compensation; }
+};
+
+
+// Sum of term(i) for i < count over all OpenMP threads.
+template <typename FPType, typename Term>
+FPType ompSum(const size_t count, const Accumulation accumulation, Term term) {
+    const int m = static_cast<int>(count);
+    int i;
+
+    if (accumulation == Accumulation::Plain) {
+        FPType sum = 0;
+#if defined(_OPENMP) && _OPENMP >= 201307
+#pragma omp parallel for simd schedule(static) private(i) reduction(+:sum)
+#else
+#pragma omp parallel for schedule(static) private(i) reduction(+:sum)
+#endif
+        for (i = 0; i < m; ++i)
+            sum += term(i);
+
+        return sum;
+    }
+
+    std::vector<FPType> partials(omp_get_max_threads(), 0);
+#pragma omp parallel private(i)
+    {
+        KahanSum<FPType> acc;
+        #pragma omp for schedule(static)
+        for (i = 0; i < m; ++i)
+            acc.add(term(i));
+        partials[omp_get_thread_num()] = acc.result();
+    }
+
+    KahanSum<FPType> total;
+    for (const FPType partial : partials)
+        total.add(partial);
+
+    return total.result();
+}
+
+
+template <typename FPType>
+auto omp_dot(const size_t n, const FPType *x, const size_t incx, const FPType *y, const size_t incy, FPType& result,
+             const Accumulation accumulation = Accumulation::Plain) {
+    const size_t count = std::min(stridedCount(n, incx), stridedCount(n, incy));
+    auto t0 = std::chrono::steady_clock::now();
+    result = ompSum<FPType>(count, accumulation, [=](const int i) { return x[i * incx] * y[i * incy]; });
+
+    return std::chrono::steady_clock::now() - t0;
+}
+
+template <typename FPType>
+auto omp_nrm2(const size_t n, const FPType *x, const size_t incx, FPType& result,
+              const Accumulation accumulation = Accumulation::Plain) {
+    auto t0 = std::chrono::steady_clock::now();
+    result = std::sqrt(ompSum<FPType>(stridedCount(n, incx), accumulation,
+                                      [=](const int i) { return x[i * incx] * x[i * incx]; }));
+
+    return std::chrono::steady_clock::now() - t0;
+}
+
+template <typename FPType>
+auto omp_asum(const size_t n, const FPType *x, const size_t incx, FPType& result,
+              const Accumulation accumulation = Accumulation::Plain) {
+    auto t0 = std::chrono::steady_clock::now();
+    result = ompSum<FPType>(stridedCount(n, incx), accumulation, [=](const int i) { return std::fabs(x[i * incx]); });
+
+    return std::chrono::steady_clock::now() - t0;
+}
+
+template <typename FPType>
+auto omp_sum(const size_t n, const FPType *x, const size_t incx, FPType& result,
+             const Accumulation accumulation = Accumulation::Plain) {
+    auto t0 = std::chrono::steady_clock::now();
+    result = ompSum<FPType>(stridedCount(n, incx), accumulation, [=](const int i) { return x[i * incx]; });
+
+    return std::chrono::steady_clock::now() - t0;
+}
+
+// 0-based index of the first element of largest magnitude (0 for an empty vector).
+template <typename FPType>
+auto omp_iamax(const size_t n, const FPType *x, const size_t incx, size_t& result) {
+    const int m = static_cast<int>(stridedCount(n, incx));
+    std::vector<FPType> bestValues(omp_get_max_threads(), -1);
+    std::vector<int> bestIndices(omp_get_max_threads(), 0);
+    int i;
+
+    auto t0 = std::chrono::steady_clock::now();
+#pragma omp parallel private(i)
+    {
+        FPType bestValue = -1;
+        int bestIndex = 0;
+        #pragma omp for schedule(static)
+        for (i = 0; i < m; ++i) {
+            const FPType value = std::fabs(x[i * incx]);
+            if (value > bestValue) {
+                bestValue = value;
+                bestIndex = i;
+            }
+        }
+        bestValues[omp_get_thread_num()] = bestValue;
+        bestIndices[omp_get_thread_num()] = bestIndex;
+    }
+
+    // Static chunks are ordered by thread, so a strict comparison keeps the first maximum.
+    size_t best = 0;
+    for (size_t t = 1; t < bestValues.size(); ++t)
+        if (bestValues[t] > bestValues[best]) best = t;
+    result = bestIndices[best];
+
+    return std::chrono::steady_clock::now() - t0;
+}
+
+
+// Device side of the reductions for one context and device. Works on cl_mem buffers already on
+// the device, so other code (e.g. the Jacobi residual) can reduce its data without a read-back.
+// Not thread-safe: kernel arguments are set per call.
+template <typename FPType>
+class DeviceReduction {
+public:
+    DeviceReduction(cl_context context, cl_device_id device, const Accumulation accumulation = Accumulation::Plain) {
+        std::string options = sizeof(FPType) == sizeof(double) ? "-D USE_DOUBLE" : "";
+        if (accumulation == Accumulation::Kahan) options += " -D KAHAN";
+        if (supportsSubgroups(device)) options += " -cl-std=CL2.0 -D USE_SUBGROUPS";
+
+        program_ = buildProgram(context, device, REDUCE_KERNEL_FILE, options.c_str());
+        const char *names[] = {"dot_partial", "nrm2_partial", "asum_partial", "sum_partial", "sum_final",
+                               "iamax_partial", "iamax_final"};
+        for (int k = 0; k < KernelCount; ++k) {
+            cl_int retCode = 0;
+            kernels_[k] = clCreateKernel(program_, names[k], &retCode);
+            asyncCheck(retCode, "clCreateKernel");
+        }
+
+        groupSize_ = 256;
+        for (cl_kernel kernel : kernels_) {
+            size_t maxGroupSize = 0;
+            clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &maxGroupSize, 0);
+            groupSize_ = std::max<size_t>(1, std::min(groupSize_, maxGroupSize));
+        }
+
+        // Enough groups to keep every compute unit busy; stage 2 loops over them in one group.
+        cl_uint computeUnits = 1;
+        clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &computeUnits, nullptr);
+        maxGroups_ = std::min<size_t>(1024, 8 * std::max<cl_uint>(1, computeUnits));
+
+        cl_int retCode = 0;
+        partial_ = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(FPType) * maxGroups_, 0, &retCode);
+        asyncCheck(retCode, "clCreateBuffer partial");
+        partialIndex_ = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_ulong) * maxGroups_, 0, &retCode);
+        asyncCheck(retCode, "clCreateBuffer partialIndex");
+        result_ = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_ulong), 0, &retCode);
+        asyncCheck(retCode, "clCreateBuffer result");
+    }
+
+    DeviceReduction(const DeviceReduction&) = delete;
+    DeviceReduction& operator=(const DeviceReduction&) = delete;
+
+    ~DeviceReduction() {
+        clReleaseMemObject(partial_);
+        clReleaseMemObject(partialIndex_);
+        clReleaseMemObject(result_);
+        for (cl_kernel kernel : kernels_)
+            clReleaseKernel(kernel);
+        clReleaseProgram(program_);
+    }
+
+    FPType dot(cl_command_queue queue, const size_t n, cl_mem x, const size_t incx, cl_mem y, const size_t incy) {
+        const cl_ulong count = std::min(stridedCount(n, incx), stridedCount(n, incy));
+        const cl_ulong incX = incx, incY = incy;
+        cl_kernel kernel = kernels_[DotPartial];
+        asyncCheck(clSetKernelArg(kernel, 0, sizeof(cl_ulong), &count), "clSetKernelArg count");
+        asyncCheck(clSetKernelArg(kernel, 1, sizeof(cl_mem), &x), "clSetKernelArg x");
+        asyncCheck(clSetKernelArg(kernel, 2, sizeof(cl_ulong), &incX), "clSetKernelArg incx");
+        asyncCheck(clSetKernelArg(kernel, 3, sizeof(cl_mem), &y), "clSetKernelArg y");
+        asyncCheck(clSetKernelArg(kernel, 4, sizeof(cl_ulong), &incY), "clSetKernelArg incy");
+
+        return reduceSum(queue, kernel, 5, count);
+    }
+
+    FPType nrm2(cl_command_queue queue, const size_t n, cl_mem x, const size_t incx) {
+        return std::sqrt(reduceVector(queue, kernels_[Nrm2Partial], n, x, incx));
+    }
+
+    FPType asum(cl_command_queue queue, const size_t n, cl_mem x, const size_t incx) {
+        return reduceVector(queue, kernels_[AsumPartial], n, x, incx);
+    }
+
+    FPType sum(cl_command_queue queue, const size_t n, cl_mem x, const size_t incx) {
+        return reduceVector(queue, kernels_[SumPartial], n, x, incx);
+    }
+
+    // 0-based index of the first element of largest magnitude (0 for an empty vector).
+    size_t iamax(cl_command_queue queue, const size_t n, cl_mem x, const size_t incx) {
+        const cl_ulong count = stridedCount(n, incx), incX = incx;
+        if (count == 0) return 0;
+
+        cl_kernel partialKernel = kernels_[IamaxPartial];
+        asyncCheck(clSetKernelArg(partialKernel, 0, sizeof(cl_ulong), &count), "clSetKernelArg count");
+        asyncCheck(clSetKernelArg(partialKernel, 1, sizeof(cl_mem), &x), "clSetKernelArg x");
+        asyncCheck(clSetKernelArg(partialKernel, 2, sizeof(cl_ulong), &incX), "clSetKernelArg incx");
+        asyncCheck(clSetKernelArg(partialKernel, 3, sizeof(cl_mem), &partial_), "clSetKernelArg partialValue");
+        asyncCheck(clSetKernelArg(partialKernel, 4, sizeof(cl_mem), &partialIndex_), "clSetKernelArg partialIndex");
+        asyncCheck(clSetKernelArg(partialKernel, 5, sizeof(FPType) * groupSize_, nullptr), "clSetKernelArg scratchValue");
+        asyncCheck(clSetKernelArg(partialKernel, 6, sizeof(cl_ulong) * groupSize_, nullptr), "clSetKernelArg scratchIndex");
+
+        const cl_ulong groups = launchGroups(count);
+        size_t global = groups * groupSize_;
+        asyncCheck(clEnqueueNDRangeKernel(queue, partialKernel, 1, 0, &global, &groupSize_, 0, 0, 0), "clEnqueueNDRangeKernel iamax_partial");
+
+        cl_kernel finalKernel = kernels_[IamaxFinal];
+        asyncCheck(clSetKernelArg(finalKernel, 0, sizeof(cl_ulong), &groups), "clSetKernelArg count");
+        asyncCheck(clSetKernelArg(finalKernel, 1, sizeof(cl_mem), &partial_), "clSetKernelArg partialValue");
+        asyncCheck(clSetKernelArg(finalKernel, 2, sizeof(cl_mem), &partialIndex_), "clSetKernelArg partialIndex");
+        asyncCheck(clSetKernelArg(finalKernel, 3, sizeof(cl_mem), &result_), "clSetKernelArg result");
+        asyncCheck(clSetKernelArg(finalKernel, 4, sizeof(FPType) * groupSize_, nullptr), "clSetKernelArg scratchValue");
+        asyncCheck(clSetKernelArg(finalKernel, 5, sizeof(cl_ulong) * groupSize_, nullptr), "clSetKernelArg scratchIndex");
+        asyncCheck(clEnqueueNDRangeKernel(queue, finalKernel, 1, 0, &groupSize_, &groupSize_, 0, 0, 0), "clEnqueueNDRangeKernel iamax_final");
+
+        cl_ulong index = 0;
+        asyncCheck(clEnqueueReadBuffer(queue, result_, CL_TRUE, 0, sizeof(cl_ulong), &index, 0, 0, 0), "clEnqueueReadBuffer result");
+
+        return static_cast<size_t>(index);
+    }
+
+private:
+    enum { DotPartial, Nrm2Partial, AsumPartial, SumPartial, SumFinal, IamaxPartial, IamaxFinal, KernelCount };
+
+    static bool supportsSubgroups(cl_device_id device) {
+        size_t size = 0;
+        clGetDeviceInfo(device, CL_DEVICE_EXTENSIONS, 0, nullptr, &size);
+        std::string extensions(size, '\0');
+        clGetDeviceInfo(device, CL_DEVICE_EXTENSIONS, size, &extensions[0], nullptr);
+
+        // Sub-group built-ins need OpenCL C 2.0; the version string is "OpenCL C <major>.<minor> ...".
+        char version[128] = {};
+        clGetDeviceInfo(device, CL_DEVICE_OPENCL_C_VERSION, sizeof(version) - 1, version, nullptr);
+
+        return extensions.find("cl_khr_subgroups") != std::string::npos && std::atoi(version + 9) >= 2;
+    }
+
+    cl_ulong launchGroups(const cl_ulong count) const {
+        return std::max<cl_ulong>(1, std::min<cl_ulong>(maxGroups_, (count + groupSize_ - 1) / groupSize_));
+    }
+
+    FPType reduceVector(cl_command_queue queue, cl_kernel kernel, const size_t n, cl_mem x, const size_t incx) {
+        const cl_ulong count = stridedCount(n, incx), incX = incx;
+        asyncCheck(clSetKernelArg(kernel, 0, sizeof(cl_ulong), &count), "clSetKernelArg count");
+        asyncCheck(clSetKernelArg(kernel, 1, sizeof(cl_mem), &x), "clSetKernelArg x");
+        asyncCheck(clSetKernelArg(kernel, 2, sizeof(cl_ulong), &incX), "clSetKernelArg incx");
+
+        return reduceSum(queue, kernel, 3, count);
+    }
+
+    // Launches a *_partial kernel whose leading arguments are set, then sum_final over its partials.
+    FPType reduceSum(cl_command_queue queue, cl_kernel partial, const cl_uint partialArg, const cl_ulong count) {
+        if (count == 0) return 0;
+
+        asyncCheck(clSetKernelArg(partial, partialArg, sizeof(cl_mem), &partial_), "clSetKernelArg partial");
+        asyncCheck(clSetKernelArg(partial, partialArg + 1, sizeof(FPType) * groupSize_, nullptr), "clSetKernelArg scratch");
+        const cl_ulong groups = launchGroups(count);
+        size_t global = groups * groupSize_;
+        asyncCheck(clEnqueueNDRangeKernel(queue, partial, 1, 0, &global, &groupSize_, 0, 0, 0), "clEnqueueNDRangeKernel partial");
+
+        cl_kernel finalKernel = kernels_[SumFinal];
+        asyncCheck(clSetKernelArg(finalKernel, 0, sizeof(cl_ulong), &groups), "clSetKernelArg count");
+        asyncCheck(clSetKernelArg(finalKernel, 1, sizeof(cl_mem), &partial_), "clSetKernelArg partial");
+        asyncCheck(clSetKernelArg(finalKernel, 2, sizeof(cl_mem), &result_), "clSetKernelArg result");
+        asyncCheck(clSetKernelArg(finalKernel, 3, sizeof(FPType) * groupSize_, nullptr), "clSetKernelArg scratch");
+        asyncCheck(clEnqueueNDRangeKernel(queue, finalKernel, 1, 0, &groupSize_, &groupSize_, 0, 0, 0), "clEnqueueNDRangeKernel sum_final");
+
+        FPType result = 0;
+        asyncCheck(clEnqueueReadBuffer(queue, result_, CL_TRUE, 0, sizeof(FPType), &result, 0, 0, 0), "clEnqueueReadBuffer result");
+
+        return result;
+    }
+
+    cl_program program_ = nullptr;
+    cl_kernel kernels_[KernelCount] = {};
+    size_t groupSize_ = 1;
+    size_t maxGroups_ = 1;
+    cl_mem partial_ = nullptr, partialIndex_ = nullptr, result_ = nullptr;
+};
+
+
+// Host-pointer front end in the style of opencl_axpy: creates a context for deviceType, uploads
+// the vectors, runs `reduce` on the DeviceReduction and returns the time of the reduction alone.
+template <typename FPType, typename Reduce>
+auto opencl_reduce_impl(const std::vector<std::pair<const FPType*, size_t>>& vectors, cl_device_type deviceType,
+                        const Accumulation accumulation, Reduce reduce) {
+    cl_context context;
+    cl_device_id device;
+    std::chrono::steady_clock::duration time{};
+    if (createDeviceContext(deviceType, context, device)) return time;
+
+    cl_int retCode = 0;
+    cl_command_queue queue = clCreateCommandQueueWithProperties(context, device, 0, &retCode);
+    asyncCheck(retCode, "clCreateCommandQueueWithProperties");
+
+    std::vector<cl_mem> buffers;
+    for (const auto& vector : vectors) {
+        // Zero-length buffers are invalid; reserve one element.
+        const size_t biteSize = sizeof(FPType) * std::max<size_t>(1, vector.second);
+        cl_mem buffer = clCreateBuffer(context, CL_MEM_READ_ONLY, biteSize, 0, &retCode);
+        asyncCheck(retCode, "clCreateBuffer");
+        if (vector.second)
+            asyncCheck(clEnqueueWriteBuffer(queue, buffer, CL_TRUE, 0, sizeof(FPType) * vector.second, vector.first, 0, 0, 0),
+                       "clEnqueueWriteBuffer");
+        buffers.push_back(buffer);
+    }
+
+    {
+        DeviceReduction<FPType> reduction(context, device, accumulation);
+        auto t0 = std::chrono::steady_clock::now();
+        reduce(reduction, queue, buffers);
+        time = std::chrono::steady_clock::now() - t0;
+    }
+
+    for (cl_mem buffer : buffers)
+        clReleaseMemObject(buffer);
+    clReleaseCommandQueue(queue);
+    clReleaseContext(context);
+
+    return time;
+}
+
+
+template <typename FPType>
+auto opencl_dot(const size_t n, const FPType *x, const size_t incx, const FPType *y, const size_t incy, FPType& result,
+                cl_device_type deviceType = CL_DEVICE_TYPE_GPU, const Accumulation accumulation = Accumulation::Plain) {
+    return opencl_reduce_impl<FPType>({{x, n}, {y, n}}, deviceType, accumulation,
+        [&](DeviceReduction<FPType>& reduction, cl_command_queue queue, const std::vector<cl_mem>& buffers) {
+            result = reduction.dot(queue, n, buffers[0], incx, buffers[1], incy);
+        });
+}
+
+template <typename FPType>
+auto opencl_nrm2(const size_t n, const FPType *x, const size_t incx, FPType& result,
+                 cl_device_type deviceType = CL_DEVICE_TYPE_GPU, const Accumulation accumulation = Accumulation::Plain) {
+    return opencl_reduce_impl<FPType>({{x, n}}, deviceType, accumulation,
+        [&](DeviceReduction<FPType>& reduction, cl_command_queue queue, const std::vector<cl_mem>& buffers) {
+            result = reduction.nrm2(queue, n, buffers[0], incx);
+        });
+}
+
+template <typename FPType>
+auto opencl_asum(const size_t n, const FPType *x, const size_t incx, FPType& result,
+                 cl_device_type deviceType = CL_DEVICE_TYPE_GPU, const Accumulation accumulation = Accumulation::Plain) {
+    return opencl_reduce_impl<FPType>({{x, n}}, deviceType, accumulation,
+        [&](DeviceReduction<FPType>& reduction, cl_command_queue queue, const std::vector<cl_mem>& buffers) {
+            result = reduction.asum(queue, n, buffers[0], incx);
+        });
+}
+
+template <typename FPType>
+auto opencl_sum(const size_t n, const FPType *x, const size_t incx, FPType& result,
+                cl_device_type deviceType = CL_DEVICE_TYPE_GPU, const Accumulation accumulation = Accumulation::Plain) {
+    return opencl_reduce_impl<FPType>({{x, n}}, deviceType, accumulation,
+        [&](DeviceReduction<FPType>& reduction, cl_command_queue queue, const std::vector<cl_mem>& buffers) {
+            result = reduction.sum(queue, n, buffers[0], incx);
+        });
+}
+
+template <typename FPType>
+auto opencl_iamax(const size_t n, const FPType *x, const size_t incx, size_t& result,
+                  cl_device_type deviceType = CL_DEVICE_TYPE_GPU) {
+    return opencl_reduce_impl<FPType>({{x, n}}, deviceType, Accumulation::Plain,
+        [&](DeviceReduction<FPType>& reduction, cl_command_queue queue, const std::vector<cl_mem>& buffers) {
+            result = reduction.iamax(queue, n, buffers[0], incx);
+        });
+}
@@ -0,0 +1,305 @@
+#pragma once
+
+#include "async.h"
+#include "jit.h"
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <typeindex>
+#include <vector>
+#include <map>
+#include <string>
+#include <cstdint>
+
+
+// Bounded lock-free multi-producer/multi-consumer queue (Vyukov): every cell carries a sequence
+// number telling producers and consumers whose turn it is, so a push or pop is a single CAS.
+template <typename T>
+class MpmcQueue {
+public:
+    explicit MpmcQueue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        mask_ = size - 1;
+        cells_.reset(new Cell[size]);
+        for (size_t i = 0; i < size; ++i)
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    MpmcQueue(const MpmcQueue&) = delete;
+    MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+    bool tryPush(const T& value) {
+        Cell *cell;
+        size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &cells_[pos & mask_];
+            const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            }
+            else if (diff < 0) {
+                return false;
+            }
+            else {
+                pos = enqueuePos_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = value;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    bool tryPop(T& value) {
+        Cell *cell;
+        size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &cells_[pos & mask_];
+            const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            }
+            else if (diff < 0) {
+                return false;
+            }
+            else {
+                pos = dequeuePos_.load(std::memory_order_relaxed);
+            }
+        }
+        value = cell->value;
+        cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+
+        return true;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> cells_;
+    size_t mask_ = 0;
+    alignas(64) std::atomic<size_t> enqueuePos_{0};
+    alignas(64) std::atomic<size_t> dequeuePos_{0};
+};
+
+
+class ComputeService;
+
+
+// Fails the running job: the message is printed like the other OpenCL errors and carried by the
+// job's future.
+[[noreturn]] inline void serviceFail(const char *message) {
+    printf("Error: %s\n", message);
+    throw std::runtime_error(message);
+}
+
+
+// State owned by one dispatcher thread: its own in-order queue and its own cl_kernel objects,
+// since clSetKernelArg on a kernel shared between threads is not safe.
+class ServiceWorker {
+public:
+    ServiceWorker(ComputeService& service, cl_command_queue queue) : service_(service), queue_(queue) {}
+    ServiceWorker(const ServiceWorker&) = delete;
+    ServiceWorker& operator=(const ServiceWorker&) = delete;
+    ~ServiceWorker();
+
+    cl_context context() const;
+    cl_device_id device() const;
+    cl_command_queue queue() const { return queue_; }
+    cl_kernel kernel(const char *filename, const char *kernelName, const char *options = nullptr);
+    cl_kernel specializedKernel(const char *filename, const char *kernelName, const std::string& shape,
+                                bool *specialized = nullptr);
+
+    // This worker's T, constructed from (context, device) on first use and kept for the worker's
+    // lifetime: for helpers such as DeviceReduction that, like a cl_kernel, hold per-thread state.
+    template <typename T>
+    T& resource();
+
+private:
+    ComputeService& service_;
+    cl_command_queue queue_;
+    std::map<std::string, cl_kernel> kernels_;
+    std::map<std::type_index, std::shared_ptr<void>> resources_;
+};
+
+
+// Thread-safe front end: any number of host threads submit jobs through a lock-free queue to a
+// few dispatcher threads. All of them share one context and one set of built programs.
+class ComputeService {
+public:
+    using Duration = std::chrono::steady_clock::duration;
+    using Job = std::packaged_task<Duration(ServiceWorker&)>;
+
+    explicit ComputeService(cl_device_type deviceType, const unsigned dispatchers = 2,
+                            const size_t queueCapacity = 1024) : jobs_(queueCapacity) {
+        if (createDeviceContext(deviceType, context_, device_)) return;
+
+        for (unsigned i = 0; i < std::max(dispatchers, 1u); ++i) {
+            cl_int retCode = 0;
+            cl_command_queue queue = clCreateCommandQueueWithProperties(context_, device_, 0, &retCode);
+            asyncCheck(retCode, "clCreateCommandQueueWithProperties");
+            if (!retCode) dispatchers_.emplace_back(&ComputeService::dispatch, this, queue);
+        }
+    }
+
+    ComputeService(const ComputeService&) = delete;
+    ComputeService& operator=(const ComputeService&) = delete;
+
+    ~ComputeService() {
+        stopping_.store(true, std::memory_order_release);
+        for (auto& dispatcher : dispatchers_)
+            dispatcher.join();
+        for (auto& entry : programs_)
+            clReleaseProgram(entry.second);
+        if (context_) clReleaseContext(context_);
+    }
+
+    bool valid() const { return context_ != nullptr && !dispatchers_.empty(); }
+    cl_context context() const { return context_; }
+    cl_device_id device() const { return device_; }
+    KernelJit& jit() { return jit_; }
+
+    // Builds each (file, options) pair once for the whole process; later calls only take the lock.
+    cl_program program(const char *filename, const char *options = nullptr) {
+        std::lock_guard<std::mutex> lock(programsMutex_);
+        std::string key = std::string(filename) + ':' + (options ? options : "");
+        auto it = programs_.find(key);
+        if (it != programs_.end()) return it->second;
+
+        cl_program program = buildProgram(context_, device_, filename, options);
+        programs_[key] = program;
+
+        return program;
+    }
+
+    // Thread-safe. The job runs on a dispatcher thread and the future yields its kernel time;
+    // without a device the job is dropped and the future reports a broken promise. A job that
+    // cannot run throws (see serviceFail), and the future's get() rethrows the error.
+    template <typename Function>
+    std::future<Duration> submit(Function&& function) {
+        Job *job = new Job(std::forward<Function>(function));
+        std::future<Duration> result = job->get_future();
+        if (!valid()) {
+            delete job;
+            return result;
+        }
+        while (!jobs_.tryPush(job))
+            std::this_thread::yield();
+
+        return result;
+    }
+
+private:
+    void dispatch(cl_command_queue queue) {
+        ServiceWorker worker(*this, queue);
+        unsigned idle = 0;
+        Job *job = nullptr;
+        for (;;) {
+            if (jobs_.tryPop(job)) {
+                (*job)(worker);
+                delete job;
+                idle = 0;
+            }
+            else if (stopping_.load(std::memory_order_acquire)) {
+                break;
+            }
+            else if (++idle < 64) {
+                std::this_thread::yield();
+            }
+            else {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        }
+        clReleaseCommandQueue(queue);
+    }
+
+    cl_context context_ = nullptr;
+    cl_device_id device_ = nullptr;
+    MpmcQueue<Job*> jobs_;
+    std::vector<std::thread> dispatchers_;
+    std::atomic<bool> stopping_{false};
+    std::mutex programsMutex_;
+    std::map<std::string, cl_program> programs_;
+    KernelJit jit_;
+};
+
+
+inline ServiceWorker::~ServiceWorker() {
+    for (auto& entry : kernels_)
+        clReleaseKernel(entry.second);
+}
+
+inline cl_context ServiceWorker::context() const { return service_.context(); }
+
+inline cl_device_id ServiceWorker::device() const { return service_.device(); }
+
+template <typename T>
+T& ServiceWorker::resource() {
+    std::shared_ptr<void>& slot = resources_[std::type_index(typeid(T))];
+    if (!slot) slot = std::make_shared<T>(context(), device());
+
+    return *static_cast<T*>(slot.get());
+}
+
+inline cl_kernel ServiceWorker::kernel(const char *filename, const char *kernelName, const char *options) {
+    std::string key = std::string(filename) + ':' + kernelName + ':' + (options ? options : "");
+    auto it = kernels_.find(key);
+    if (it != kernels_.end()) return it->second;
+
+    cl_int retCode = 0;
+    cl_kernel kernel = clCreateKernel(service_.program(filename, options), kernelName, &retCode);
+    asyncCheck(retCode, "clCreateKernel");
+    kernels_[key] = kernel;
+
+    return kernel;
+}
+
+// The kernel built for `shape` (see KernelJit) once the shape is hot, else the generic one;
+// `specialized` tells the caller which, since a specialized kernel may expect an exact range.
+inline cl_kernel ServiceWorker::specializedKernel(const char *filename, const char *kernelName, const std::string& shape,
+                                                  bool *specialized) {
+    const std::string name = std::string(filename) + ':' + kernelName;
+    const std::string options = service_.jit().options(name, shape);
+    cl_kernel kernel = options.empty() ? nullptr : this->kernel(filename, kernelName, options.c_str());
+    if (!options.empty() && !kernel) service_.jit().reject(name, shape);
+
+    if (specialized) *specialized = kernel != nullptr;
+
+    return kernel ? kernel : this->kernel(filename, kernelName);
+}
+
+
+// Stress benchmark: `clients` host threads each issue `requests` blocking calls of submitOne
+// (which must return a future) at once. Returns completed requests per second.
+template <typename Submit>
+double measureThroughput(const unsigned clients, const unsigned requests, Submit submitOne) {
+    std::vector<std::thread> threads;
+    std::atomic<bool> start{false};
+
+    for (unsigned i = 0; i < clients; ++i) {
+        threads.emplace_back([&]() {
+            while (!start.load(std::memory_order_acquire))
+                std::this_thread::yield();
+            for (unsigned r = 0; r < requests; ++r)
+                submitOne().wait();
+        });
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+    start.store(true, std::memory_order_release);
+    for (auto& thread : threads)
+        thread.join();
+    std::chrono::duration<double> time = std::chrono::steady_clock::now() - t0;
+
+    return clients * requests / time.count();
+}
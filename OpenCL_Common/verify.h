@@ -0,0 +1,167 @@
+#pragma once
+
+#include <CL/cl.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+
+// True when some platform exposes a device of this type, so that the drivers can skip the GPU
+// backends on GPU-less machines (e.g. pocl on a CPU-only Linux box) instead of crashing.
+inline bool deviceAvailable(cl_device_type deviceType) {
+    cl_uint platformsCount = 0;
+    if (clGetPlatformIDs(0, nullptr, &platformsCount) != CL_SUCCESS || platformsCount == 0) return false;
+    std::vector<cl_platform_id> platforms(platformsCount);
+    clGetPlatformIDs(platformsCount, platforms.data(), nullptr);
+
+    // The labs always create their context on the first platform.
+    cl_uint devicesCount = 0;
+    return clGetDeviceIDs(platforms[0], deviceType, 0, nullptr, &devicesCount) == CL_SUCCESS && devicesCount > 0;
+}
+
+
+template <typename FPType, typename Allocator>
+void fillRandom(std::vector<FPType, Allocator>& values, const unsigned seed, const double low = -1.0, const double high = 1.0) {
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<double> distribution(low, high);
+    for (auto& value : values)
+        value = static_cast<FPType>(distribution(generator));
+}
+
+
+// max |result - reference| / max(1, |reference|) over n entries. A NaN entry makes the result
+// NaN, which Verifier::check fails, rather than being skipped by the comparison.
+template <typename FPType>
+double maxError(const size_t n, const FPType *result, const double *reference) {
+    double error = 0.0;
+    for (size_t i = 0; i < n; ++i) {
+        const double diff = std::fabs(static_cast<double>(result[i]) - reference[i]) / std::max(1.0, std::fabs(reference[i]));
+        if (std::isnan(diff)) return diff;
+        error = std::max(error, diff);
+    }
+
+    return error;
+}
+
+
+class Verifier {
+public:
+    bool check(const std::string& name, const double error, const double tolerance) {
+        const bool passed = error <= tolerance && !std::isnan(error);
+        printf("%s: %s (error %.3g, tolerance %.3g)\n", name.c_str(), passed ? "PASSED" : "FAILED", error, tolerance);
+        if (!passed) ++failures_;
+        return passed;
+    }
+
+    void fail(const std::string& name, const std::string& reason) {
+        printf("%s: FAILED (%s)\n", name.c_str(), reason.c_str());
+        ++failures_;
+    }
+
+    void skip(const std::string& name, const char *reason) {
+        printf("%s: SKIPPED (%s)\n", name.c_str(), reason);
+    }
+
+    int failures() const { return failures_; }
+
+private:
+    int failures_ = 0;
+};
+
+
+// Self-test of the checks above: a backend that writes NaN or garbage must fail. The inner
+// Verifier prints the expected FAILED lines; the outer one fails if any of them passed.
+inline void verify_verifier(Verifier& verifier) {
+    const double reference[] = {1.0, -2.0, 0.5};
+    const float nanResult[] = {1.0f, NAN, 0.5f};
+    const float garbageResult[] = {1.0f, -2.0f, 1e30f};
+
+    Verifier expectFailures;
+    expectFailures.check("NaN result (must fail)", maxError(3, nanResult, reference), 1e-5);
+    expectFailures.check("garbage result (must fail)", maxError(3, garbageResult, reference), 1e-5);
+    if (expectFailures.failures() != 2)
+        verifier.fail("verifier self-test", "a NaN or garbage result passed");
+}
+
+
+// Timing baselines kept as a flat JSON object {"backend": milliseconds, ...}. A backend regresses
+// when it is slower than its baseline by more than the threshold (25% unless the
+// OPENCL_LABS_REGRESSION_THRESHOLD environment variable says otherwise) and by at least 5 ms, so
+// that timer noise on tiny runs is not reported. The file is written when it does not exist yet
+// or when OPENCL_LABS_UPDATE_BASELINE is set.
+class TimingBaseline {
+public:
+    explicit TimingBaseline(const char *filename) : filename_(filename) {
+        const char *threshold = std::getenv("OPENCL_LABS_REGRESSION_THRESHOLD");
+        if (threshold) threshold_ = std::atof(threshold);
+        update_ = std::getenv("OPENCL_LABS_UPDATE_BASELINE") != nullptr;
+
+        std::ifstream ifs(filename);
+        exists_ = ifs.good();
+        std::string content{ std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>() };
+        size_t pos = 0;
+        while ((pos = content.find('"', pos)) != std::string::npos) {
+            const size_t end = content.find('"', pos + 1);
+            const size_t colon = content.find(':', end);
+            if (end == std::string::npos || colon == std::string::npos) break;
+            baseline_[content.substr(pos + 1, end - pos - 1)] = std::atof(content.c_str() + colon + 1);
+            pos = content.find_first_of(",}", colon);
+            if (pos == std::string::npos) break;
+        }
+    }
+
+    template <typename Duration>
+    void record(const std::string& name, const Duration time) {
+        current_[name] = std::chrono::duration<double, std::milli>(time).count();
+    }
+
+    void compare(Verifier& verifier) const {
+        printf("\nTiming baseline %s:\n", filename_.c_str());
+        for (const auto& entry : current_) {
+            auto it = baseline_.find(entry.first);
+            if (it == baseline_.end()) {
+                printf("%s: %.1f ms (no baseline)\n", entry.first.c_str(), entry.second);
+                continue;
+            }
+            const double limit = it->second * (1.0 + threshold_);
+            if (entry.second > limit && entry.second - it->second > 5.0) {
+                char reason[128];
+                snprintf(reason, sizeof(reason), "%.1f ms, baseline %.1f ms", entry.second, it->second);
+                verifier.fail(entry.first + " timing", reason);
+            }
+            else {
+                printf("%s: %.1f ms (baseline %.1f ms)\n", entry.first.c_str(), entry.second, it->second);
+            }
+        }
+    }
+
+    void save() const {
+        if (exists_ && !update_) return;
+
+        std::map<std::string, double> merged = baseline_;
+        for (const auto& entry : current_)
+            merged[entry.first] = entry.second;
+
+        std::ofstream ofs(filename_);
+        ofs << "{\n";
+        size_t i = 0;
+        for (const auto& entry : merged)
+            ofs << "    \"" << entry.first << "\": " << entry.second << (++i < merged.size() ? ",\n" : "\n");
+        ofs << "}\n";
+    }
+
+private:
+    std::string filename_;
+    double threshold_ = 0.25;
+    bool exists_ = false;
+    bool update_ = false;
+    std::map<std::string, double> baseline_;
+    std::map<std::string, double> current_;
+};
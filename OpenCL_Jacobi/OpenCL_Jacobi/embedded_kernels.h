@@ -0,0 +1,415 @@
+// Generated from the .cl files by OpenCL_Common/embed_kernels.ps1, do not edit.
+#pragma once
+
+#include "../../OpenCL_Common/kernels.h"
+
+static const EmbeddedKernel jacobi_kernel_embedded("jacobi_kernel.cl",
+    R"CLSRC(__kernel void jacobi(__global float *A, __global float *b, __global float *x0, 
+                     __global float *x1, __global float *norm)
+{
+    const size_t i = get_global_id(0);
+    // Built with -D N=<size> for a hot size (KernelJit), the row loop has a constant trip count.
+#ifdef N
+    const size_t size = N;
+#else
+    const size_t size = get_global_size(0);
+#endif
+
+    float acc = 0.0f;
+    for (size_t j = 0; j < size; j++) {
+        acc += A[i * size + j] * x0[j] * (float)(i != j);
+    }
+    x1[i] = (b[i] - acc) / A[i * size + i];
+    norm[i] = x0[i] - x1[i];
+}
+)CLSRC"
+);
+
+static const EmbeddedKernel reduce_kernel_embedded("reduce_kernel.cl",
+    R"CLSRC(// Two-stage reductions: every work-group of the *_partial kernels reduces a grid-stride slice of
+// the input to one partial, and the *_final kernels, launched as a single work-group, reduce the
+// partials. Build options: -D USE_DOUBLE, -D KAHAN (compensated per-work-item sums) and
+// -D USE_SUBGROUPS (cl_khr_subgroups, OpenCL C 2.0).
+
+#ifdef USE_DOUBLE
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+typedef double real;
+#else
+typedef float real;
+#endif
+
+#ifdef USE_SUBGROUPS
+#pragma OPENCL EXTENSION cl_khr_subgroups : enable
+#endif
+
+
+typedef struct {
+    real sum;
+    real compensation;
+} accumulator;
+
+void accumulate(accumulator *acc, const real value) {
+#ifdef KAHAN
+    const real y = value - acc->compensation;
+    const real t = acc->sum + y;
+    acc->compensation = (t - acc->sum) - y;
+    acc->sum = t;
+#else
+    acc->sum += value;
+#endif
+}
+
+real accumulated(const accumulator acc) {
+    return acc.sum - acc.compensation;
+}
+
+
+// Pairwise tree over `count` entries of scratch; count need not be a power of two.
+real treeReduceSum(__local real *scratch, const uint count) {
+    const uint lid = get_local_id(0);
+    for (uint active = count; active > 1; ) {
+        const uint half = (active + 1) / 2;
+        if (lid < active - half)
+            scratch[lid] += scratch[lid + half];
+        barrier(CLK_LOCAL_MEM_FENCE);
+        active = half;
+    }
+
+    return scratch[0];
+}
+
+real groupReduceSum(real value, __local real *scratch) {
+#ifdef USE_SUBGROUPS
+    value = sub_group_reduce_add(value);
+    if (get_sub_group_local_id() == 0)
+        scratch[get_sub_group_id()] = value;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    const real result = treeReduceSum(scratch, get_num_sub_groups());
+#else
+    scratch[get_local_id(0)] = value;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    const real result = treeReduceSum(scratch, get_local_size(0));
+#endif
+    // scratch may be reused by the caller right away.
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    return result;
+}
+
+
+// (value, index) pairs for iamax: the larger value wins, the smaller index breaks ties, so the
+// result is the first index of the maximum as in BLAS.
+bool better(const real value, const ulong index, const real bestValue, const ulong bestIndex) {
+    return value > bestValue || (value == bestValue && index < bestIndex);
+}
+
+void groupReduceMax(real *value, ulong *index, __local real *scratchValue, __local ulong *scratchIndex) {
+    const uint lid = get_local_id(0);
+#ifdef USE_SUBGROUPS
+    const real subMax = sub_group_reduce_max(*value);
+    const ulong subIndex = sub_group_reduce_min(*value == subMax ? *index : ULONG_MAX);
+    if (get_sub_group_local_id() == 0) {
+        scratchValue[get_sub_group_id()] = subMax;
+        scratchIndex[get_sub_group_id()] = subIndex;
+    }
+    uint active = get_num_sub_groups();
+#else
+    scratchValue[lid] = *value;
+    scratchIndex[lid] = *index;
+    uint active = get_local_size(0);
+#endif
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    while (active > 1) {
+        const uint half = (active + 1) / 2;
+        if (lid < active - half &&
+            better(scratchValue[lid + half], scratchIndex[lid + half], scratchValue[lid], scratchIndex[lid])) {
+            scratchValue[lid] = scratchValue[lid + half];
+            scratchIndex[lid] = scratchIndex[lid + half];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+        active = half;
+    }
+
+    *value = scratchValue[0];
+    *index = scratchIndex[0];
+}
+
+
+__kernel void dot_partial(const ulong count, __global const real *x, const ulong incx, __global const real *y,
+                          const ulong incy, __global real *partial, __local real *scratch) {
+    accumulator acc = {0, 0};
+    for (ulong i = get_global_id(0); i < count; i += get_global_size(0))
+        accumulate(&acc, x[i * incx] * y[i * incy]);
+
+    const real result = groupReduceSum(accumulated(acc), scratch);
+    if (get_local_id(0) == 0)
+        partial[get_group_id(0)] = result;
+}
+
+__kernel void nrm2_partial(const ulong count, __global const real *x, const ulong incx,
+                           __global real *partial, __local real *scratch) {
+    accumulator acc = {0, 0};
+    for (ulong i = get_global_id(0); i < count; i += get_global_size(0))
+        accumulate(&acc, x[i * incx] * x[i * incx]);
+
+    const real result = groupReduceSum(accumulated(acc), scratch);
+    if (get_local_id(0) == 0)
+        partial[get_group_id(0)] = result;
+}
+
+__kernel void asum_partial(const ulong count, __global const real *x, const ulong incx,
+                           __global real *partial, __local real *scratch) {
+    accumulator acc = {0, 0};
+    for (ulong i = get_global_id(0); i < count; i += get_global_size(0))
+        accumulate(&acc, fabs(x[i * incx]));
+
+    const real result = groupReduceSum(accumulated(acc), scratch);
+    if (get_local_id(0) == 0)
+        partial[get_group_id(0)] = result;
+}
+
+__kernel void sum_partial(const ulong count, __global const real *x, const ulong incx,
+                          __global real *partial, __local real *scratch) {
+    accumulator acc = {0, 0};
+    for (ulong i = get_global_id(0); i < count; i += get_global_size(0))
+        accumulate(&acc, x[i * incx]);
+
+    const real result = groupReduceSum(accumulated(acc), scratch);
+    if (get_local_id(0) == 0)
+        partial[get_group_id(0)] = result;
+}
+
+__kernel void sum_final(const ulong count, __global const real *partial, __global real *result,
+                        __local real *scratch) {
+    accumulator acc = {0, 0};
+    for (ulong i = get_local_id(0); i < count; i += get_local_size(0))
+        accumulate(&acc, partial[i]);
+
+    const real total = groupReduceSum(accumulated(acc), scratch);
+    if (get_local_id(0) == 0)
+        result[0] = total;
+}
+
+
+__kernel void iamax_partial(const ulong count, __global const real *x, const ulong incx,
+                            __global real *partialValue, __global ulong *partialIndex,
+                            __local real *scratchValue, __local ulong *scratchIndex) {
+    real bestValue = -1;
+    ulong bestIndex = ULONG_MAX;
+    for (ulong i = get_global_id(0); i < count; i += get_global_size(0)) {
+        const real value = fabs(x[i * incx]);
+        if (better(value, i, bestValue, bestIndex)) {
+            bestValue = value;
+            bestIndex = i;
+        }
+    }
+
+    groupReduceMax(&bestValue, &bestIndex, scratchValue, scratchIndex);
+    if (get_local_id(0) == 0) {
+        partialValue[get_group_id(0)] = bestValue;
+        partialIndex[get_group_id(0)] = bestIndex;
+    }
+}
+
+__kernel void iamax_final(const ulong count, __global const real *partialValue, __global const ulong *partialIndex,
+                          __global ulong *result, __local real *scratchValue, __local ulong *scratchIndex) {
+    real bestValue = -1;
+    ulong bestIndex = ULONG_MAX;
+    for (ulong i = get_local_id(0); i < count; i += get_local_size(0)) {
+        if (better(partialValue[i], partialIndex[i], bestValue, bestIndex)) {
+            bestValue = partialValue[i];
+            bestIndex = partialIndex[i];
+        }
+    }
+
+    groupReduceMax(&bestValue, &bestIndex, scratchValue, scratchIndex);
+    if (get_local_id(0) == 0)
+        result[0] = bestIndex;
+}
+)CLSRC"
+);
+
+static const EmbeddedKernel stencil_kernel_embedded("stencil_kernel.cl",
+    R"CLSRC(// Matrix-free Jacobi and red-black Gauss-Seidel sweeps for the 5-point (2D) and 7-point (3D)
+// Laplacian with zero Dirichlet boundary: x = (b + sum of neighbours) / (2 * dimensions), where
+// neighbours outside the grid count as 0. Build options:
+//   -D TEMPORAL_STEPS=<t>  sweeps per launch
+//   -D RED_BLACK           red-black Gauss-Seidel instead of Jacobi
+//   -D TILE_2D, TILE_3D_XY, TILE_3D_Z  output tile of a work-group, which has one item per point
+//
+// A work-group loads its tile with a halo of HALO points into local memory and runs all sweeps of
+// the launch there, so global memory is read and written once per TEMPORAL_STEPS sweeps. Every
+// stage updates one ring less than the previous one (a stage is a Jacobi sweep or a red or black
+// half-sweep, each of radius 1), and after HALO stages exactly the tile is valid. The halo
+// is recomputed by neighbouring groups, which is the price of not synchronizing between them.
+
+#ifndef TEMPORAL_STEPS
+#define TEMPORAL_STEPS 1
+#endif
+#ifndef TILE_2D
+#define TILE_2D 16
+#endif
+#ifndef TILE_3D_XY
+#define TILE_3D_XY 8
+#endif
+#ifndef TILE_3D_Z
+#define TILE_3D_Z 4
+#endif
+
+#ifdef RED_BLACK
+#define STAGES (2 * TEMPORAL_STEPS)
+#else
+#define STAGES TEMPORAL_STEPS
+#endif
+#define HALO STAGES
+// Stages of the last sweep, before which each item keeps its point's value for the update norm.
+#define LAST_SWEEP (STAGES - STAGES / TEMPORAL_STEPS)
+
+#define L2 (TILE_2D + 2 * HALO)
+#define L3XY (TILE_3D_XY + 2 * HALO)
+#define L3Z (TILE_3D_Z + 2 * HALO)
+
+
+// x and b are nx * ny, row-major. The range is the grid rounded up to TILE_2D x TILE_2D groups.
+__kernel void stencil_2d(const uint nx, const uint ny, const uint nz, __global const float *b,
+                         __global const float *x0, __global float *x1, __global float *norm) {
+    __local float xa[L2 * L2];
+#ifndef RED_BLACK
+    __local float xc[L2 * L2];
+#endif
+    __local float bt[L2 * L2];
+
+    const int lx = get_local_id(0), ly = get_local_id(1);
+    const int originX = (int)get_group_id(0) * TILE_2D - HALO;
+    const int originY = (int)get_group_id(1) * TILE_2D - HALO;
+
+    for (int j = ly; j < L2; j += TILE_2D) {
+        for (int i = lx; i < L2; i += TILE_2D) {
+            const int gx = originX + i, gy = originY + j;
+            const bool inside = gx >= 0 && gx < (int)nx && gy >= 0 && gy < (int)ny;
+            const int c = j * L2 + i;
+            xa[c] = inside ? x0[gy * nx + gx] : 0.0f;
+            bt[c] = inside ? b[gy * nx + gx] : 0.0f;
+#ifndef RED_BLACK
+            xc[c] = xa[c];
+#endif
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    __local float *src = xa;
+#ifdef RED_BLACK
+    __local float *dst = xa;
+#else
+    __local float *dst = xc;
+#endif
+    const int out = (ly + HALO) * L2 + lx + HALO;
+    float previous = 0.0f;
+
+    for (int s = 0; s < STAGES; ++s) {
+        if (s == LAST_SWEEP) previous = src[out];
+
+        for (int j = ly; j < L2; j += TILE_2D) {
+            for (int i = lx; i < L2; i += TILE_2D) {
+                const int gx = originX + i, gy = originY + j;
+                if (i <= s || i >= L2 - 1 - s || j <= s || j >= L2 - 1 - s) continue;
+                if (gx < 0 || gx >= (int)nx || gy < 0 || gy >= (int)ny) continue;
+#ifdef RED_BLACK
+                if (((gx + gy) & 1) != (s & 1)) continue;
+#endif
+                const int c = j * L2 + i;
+                dst[c] = (bt[c] + src[c - 1] + src[c + 1] + src[c - L2] + src[c + L2]) * 0.25f;
+            }
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        __local float *swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    const int gx = originX + lx + HALO, gy = originY + ly + HALO;
+    if (gx < (int)nx && gy < (int)ny) {
+        x1[gy * nx + gx] = src[out];
+        norm[gy * nx + gx] = previous - src[out];
+    }
+}
+
+
+// x and b are nx * ny * nz, x fastest. The range is the grid rounded up to groups of
+// TILE_3D_XY x TILE_3D_XY x TILE_3D_Z.
+__kernel void stencil_3d(const uint nx, const uint ny, const uint nz, __global const float *b,
+                         __global const float *x0, __global float *x1, __global float *norm) {
+    __local float xa[L3Z * L3XY * L3XY];
+#ifndef RED_BLACK
+    __local float xc[L3Z * L3XY * L3XY];
+#endif
+    __local float bt[L3Z * L3XY * L3XY];
+
+    const int lx = get_local_id(0), ly = get_local_id(1), lz = get_local_id(2);
+    const int originX = (int)get_group_id(0) * TILE_3D_XY - HALO;
+    const int originY = (int)get_group_id(1) * TILE_3D_XY - HALO;
+    const int originZ = (int)get_group_id(2) * TILE_3D_Z - HALO;
+    const int planeSize = L3XY * L3XY;
+
+    for (int k = lz; k < L3Z; k += TILE_3D_Z) {
+        for (int j = ly; j < L3XY; j += TILE_3D_XY) {
+            for (int i = lx; i < L3XY; i += TILE_3D_XY) {
+                const int gx = originX + i, gy = originY + j, gz = originZ + k;
+                const bool inside = gx >= 0 && gx < (int)nx && gy >= 0 && gy < (int)ny && gz >= 0 && gz < (int)nz;
+                const size_t g = ((size_t)gz * ny + gy) * nx + gx;
+                const int c = k * planeSize + j * L3XY + i;
+                xa[c] = inside ? x0[g] : 0.0f;
+                bt[c] = inside ? b[g] : 0.0f;
+#ifndef RED_BLACK
+                xc[c] = xa[c];
+#endif
+            }
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    __local float *src = xa;
+#ifdef RED_BLACK
+    __local float *dst = xa;
+#else
+    __local float *dst = xc;
+#endif
+    const int out = (lz + HALO) * planeSize + (ly + HALO) * L3XY + lx + HALO;
+    float previous = 0.0f;
+
+    for (int s = 0; s < STAGES; ++s) {
+        if (s == LAST_SWEEP) previous = src[out];
+
+        for (int k = lz; k < L3Z; k += TILE_3D_Z) {
+            for (int j = ly; j < L3XY; j += TILE_3D_XY) {
+                for (int i = lx; i < L3XY; i += TILE_3D_XY) {
+                    const int gx = originX + i, gy = originY + j, gz = originZ + k;
+                    if (i <= s || i >= L3XY - 1 - s || j <= s || j >= L3XY - 1 - s || k <= s || k >= L3Z - 1 - s) continue;
+                    if (gx < 0 || gx >= (int)nx || gy < 0 || gy >= (int)ny || gz < 0 || gz >= (int)nz) continue;
+#ifdef RED_BLACK
+                    if (((gx + gy + gz) & 1) != (s & 1)) continue;
+#endif
+                    const int c = k * planeSize + j * L3XY + i;
+                    dst[c] = (bt[c] + src[c - 1] + src[c + 1] + src[c - L3XY] + src[c + L3XY]
+                              + src[c - planeSize] + src[c + planeSize]) * (1.0f / 6.0f);
+                }
+            }
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        __local float *swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    const int gx = originX + lx + HALO, gy = originY + ly + HALO, gz = originZ + lz + HALO;
+    if (gx < (int)nx && gy < (int)ny && gz < (int)nz) {
+        const size_t g = ((size_t)gz * ny + gy) * nx + gx;
+        x1[g] = src[out];
+        norm[g] = previous - src[out];
+    }
+}
+)CLSRC"
+);
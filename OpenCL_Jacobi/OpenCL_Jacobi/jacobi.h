@@ -1,10 +1,20 @@
 #include <CL/cl.h>
+#include <omp.h>
 #include <iostream>
 #include <cstdio>
 #include <fstream>
 #include <chrono>
 #include <algorithm>
 #include <utility>
+#include <cmath>
+#include <cfloat>
+#include <vector>
+
+#include "../../OpenCL_Common/service.h"
+#include "../../OpenCL_Common/kernels.h"
+#include "../../OpenCL_Common/memory.h"
+#include "../../OpenCL_Common/reduce.h"
+#include "../../OpenCL_Common/verify.h"
 
 
 #define RET_CODE_CHECK(retCode, func, message)                                             \
@@ -20,11 +30,89 @@
     if (retCode) printf("Error: retCode = %d [%s]\n", static_cast<int>(retCode), message);
 
 
-std::string readKernel(const char *filename) {
-    std::ifstream ifs(filename);
-    std::string content{ std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>() };
+#define JACOBI_BLOCK_ROWS 8
+#define JACOBI_BLOCK_COLS 1024
+
+
+// Partial dot product of a row slice with x. Uses `omp simd` where the compiler implements
+// OpenMP 4.0; MSVC only has OpenMP 2.0, so there four independent sums keep the loop vectorizable.
+inline float jacobiDot(const float *row, const float *x, const int length) {
+#if defined(_OPENMP) && _OPENMP >= 201307
+    float acc = 0.0f;
+    #pragma omp simd reduction(+:acc)
+    for (int j = 0; j < length; ++j)
+        acc += row[j] * x[j];
+
+    return acc;
+#else
+    float acc0 = 0.0f, acc1 = 0.0f, acc2 = 0.0f, acc3 = 0.0f;
+    int j = 0;
+    for (; j + 4 <= length; j += 4) {
+        acc0 += row[j] * x[j];
+        acc1 += row[j + 1] * x[j + 1];
+        acc2 += row[j + 2] * x[j + 2];
+        acc3 += row[j + 3] * x[j + 3];
+    }
+    for (; j < length; ++j)
+        acc0 += row[j] * x[j];
+
+    return (acc0 + acc1) + (acc2 + acc3);
+#endif
+}
+
+
+// Host counterpart of opencl_jacobi_cpu with the same arguments, stopping rule and result in x1.
+// Each thread sweeps blocks of JACOBI_BLOCK_ROWS rows one JACOBI_BLOCK_COLS-wide slice of x at a
+// time, so the slice stays in L1 while it is reused by every row of the block. The residual is
+// accumulated in the same sweep. x0 and x1 are used as the ping-pong pair, so x0 is overwritten.
+auto omp_jacobi(const size_t size, const float *a, float *b, float *x0, float *x1, float *norm) {
+    const int n = static_cast<int>(size);
+    const int nBlocks = (n + JACOBI_BLOCK_ROWS - 1) / JACOBI_BLOCK_ROWS;
+    float *xOld = x0, *xNew = x1;
+
+    size_t iter = -1;
+    const size_t nIter = 200;
+    float sum = FLT_MAX;
+    const float tol = 1e-7f;
+
+    auto t0 = std::chrono::steady_clock::now();
+    while (++iter <= nIter && sqrt(sum) > tol) {
+        sum = 0.0f;
+        int block;
+
+#pragma omp parallel for schedule(static) shared(a, b, xOld, xNew, norm) private(block) reduction(+:sum)
+        for (block = 0; block < nBlocks; ++block) {
+            const int rowBegin = block * JACOBI_BLOCK_ROWS;
+            const int rowEnd = std::min(rowBegin + JACOBI_BLOCK_ROWS, n);
+            float acc[JACOBI_BLOCK_ROWS] = {};
+
+            for (int colBegin = 0; colBegin < n; colBegin += JACOBI_BLOCK_COLS) {
+                const int length = std::min(JACOBI_BLOCK_COLS, n - colBegin);
+                for (int i = rowBegin; i < rowEnd; ++i)
+                    acc[i - rowBegin] += jacobiDot(a + static_cast<size_t>(i) * n + colBegin, xOld + colBegin, length);
+            }
+
+            for (int i = rowBegin; i < rowEnd; ++i) {
+                const float diagonal = a[static_cast<size_t>(i) * n + i];
+                xNew[i] = (b[i] - (acc[i - rowBegin] - diagonal * xOld[i])) / diagonal;
+                norm[i] = xOld[i] - xNew[i];
+                sum += norm[i] * norm[i];
+            }
+        }
+
+        std::swap(xOld, xNew);
+    }
+    auto time = std::chrono::steady_clock::now() - t0;
+
+    if (xOld != x1)
+        std::copy(xOld, xOld + size, x1);
+
+    return time;
+}
+
 
-    return content;
+std::string readKernel(const char *filename) {
+    return kernelSource(filename);
 }
 
 
@@ -68,7 +156,7 @@ void initializeKernel(cl_kernel& kernel, cl_context& context, cl_command_queue&
 
     RET_CODE_RETURN_CHECK(retCode, clCreateProgramWithSource(context, 1, (const char**)&kernelSource,
         &kernelLen, &retCode), program, "clCreateProgramWithSource")
-    clBuildProgram(program, 1, &device, 0, 0, 0);
+    retCode = clBuildProgram(program, 1, &device, 0, 0, 0);
 
     if (retCode != CL_SUCCESS) {
         size_t logSize = 0;
@@ -111,7 +199,7 @@ void setKernelArguments(const size_t size, const float *a, float *b, float *x0,
                           biteSize, 0, &retCode), x1Buffer, "clCreateBuffer x1")
     RET_CODE_CHECK(retCode, clEnqueueWriteBuffer(queue, x1Buffer, CL_TRUE, 0, biteSize, x1, 0, 0, 0), "clEnqueueWriteBuffer x1")
 
-    RET_CODE_RETURN_CHECK(retCode, clCreateBuffer(context, CL_MEM_WRITE_ONLY,
+    RET_CODE_RETURN_CHECK(retCode, clCreateBuffer(context, CL_MEM_READ_WRITE,
                           biteSize, 0, &retCode), normBuffer, "clCreateBuffer norm")
     RET_CODE_CHECK(retCode, clEnqueueWriteBuffer(queue, normBuffer, CL_TRUE, 0, biteSize, norm, 0, 0, 0), "clEnqueueWriteBuffer norm")
     RET_CODE_CHECK(retCode, clSetKernelArg(kernel, 4, sizeof(cl_mem), &normBuffer), "clSetKernelArg norm")
@@ -127,37 +215,33 @@ auto opencl_jacobi_impl(const size_t size, const float *a, float *b, float *x0,
     cl_program program;
     cl_mem aBuffer, bBuffer, x0Buffer, x1Buffer, normBuffer;
     cl_int retCode = 0;
-    size_t groupSize = 256;
 
     initializeKernel(kernel, context, queue, device, program, retCode, filename, kernelName, deviceType);
     setKernelArguments(size, a, b, x0, x1, norm, kernel, context, queue, device, retCode,
                        aBuffer, bBuffer, x0Buffer, x1Buffer, normBuffer);
 
-    cl_event event;
-        printf("1\n");
-    size_t nWorkItems = (size / groupSize + !!(size % groupSize)) * groupSize;
+    // The residual norm is reduced on the device, so only one float comes back per iteration.
+    DeviceReduction<float> reduction(context, device);
+
     size_t iter = -1;
     const size_t nIter = 200;
-    float sum = FLT_MAX;
+    float residual = FLT_MAX;
     const float tol = 1e-7f;
 
     auto t0 = std::chrono::steady_clock::now();
-    while (++iter <= nIter && sqrt(sum) > tol) {
+    while (++iter <= nIter && residual > tol) {
         RET_CODE_CHECK(retCode, clSetKernelArg(kernel, 2, sizeof(cl_mem), &x0Buffer), "clSetKernelArg x0")
         RET_CODE_CHECK(retCode, clSetKernelArg(kernel, 3, sizeof(cl_mem), &x1Buffer), "clSetKernelArg x1")
 
-        RET_CODE_CHECK(retCode, clEnqueueNDRangeKernel(queue, kernel, 2, 0, &nWorkItems, &groupSize, 0, 0, &event), "clEnqueueNDRangeKernel")
-        // printf("2\n");
-        clWaitForEvents(1, &event);
-
-        sum = 0.0f;
-        for (size_t i = 0; i < size; ++i)
-            sum += norm[i] * norm[i];
+        // The kernel takes the system size from the global size, so no padding work-items.
+        RET_CODE_CHECK(retCode, clEnqueueNDRangeKernel(queue, kernel, 1, 0, &size, 0, 0, 0, 0), "clEnqueueNDRangeKernel")
+        residual = reduction.nrm2(queue, size, normBuffer, 1);
 
-        std::swap(x0, x1);
         std::swap(x0Buffer, x1Buffer);
     }
     auto time = std::chrono::steady_clock::now() - t0;
+    RET_CODE_CHECK(retCode, clEnqueueReadBuffer(queue, x0Buffer, CL_TRUE, 0, sizeof(float) * size, x1, 0, 0, 0), "clEnqueueReadBuffer x")
+    RET_CODE_CHECK(retCode, clEnqueueReadBuffer(queue, normBuffer, CL_TRUE, 0, sizeof(float) * size, norm, 0, 0, 0), "clEnqueueReadBuffer norm")
 
     clReleaseMemObject(aBuffer);
     clReleaseMemObject(bBuffer);
@@ -180,4 +264,342 @@ auto opencl_jacobi_cpu(const size_t size, const float *a, float *b, float *x0, f
 
 auto opencl_jacobi_gpu(const size_t size, const float *a, float *b, float *x0, float *x1, float *norm) {
     return opencl_jacobi_impl(size, a, b, x0, x1, norm, "jacobi_kernel.cl", "jacobi", CL_DEVICE_TYPE_GPU);
-}
\ No newline at end of file
+}
+
+
+// Thread-safe variant of opencl_jacobi_impl: runs on one of the service's dispatcher threads with
+// the shared context and program, so concurrent callers neither create contexts nor rebuild.
+// A hot size runs the kernel specialized for it. The final approximation is read back into x1.
+// As in opencl_jacobi_impl the residual norm is reduced on the device, here with the worker's own
+// DeviceReduction.
+std::future<ComputeService::Duration> opencl_jacobi_shared(ComputeService& service, const size_t size, const float *a,
+                                                           const float *b, const float *x0, float *x1) {
+    return service.submit([=](ServiceWorker& worker) {
+        cl_int retCode = 0;
+        const size_t biteSizeA = sizeof(float) * size * size;
+        const size_t biteSize  = sizeof(float) * size;
+        cl_kernel kernel = worker.specializedKernel("jacobi_kernel.cl", "jacobi", shapeOptions({{"N", size}}));
+        cl_command_queue queue = worker.queue();
+        DeviceReduction<float>& reduction = worker.resource<DeviceReduction<float>>();
+
+        cl_mem aBuffer = clCreateBuffer(worker.context(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, biteSizeA, (void*)a, &retCode);
+        asyncCheck(retCode, "clCreateBuffer a");
+        cl_mem bBuffer = clCreateBuffer(worker.context(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, biteSize, (void*)b, &retCode);
+        asyncCheck(retCode, "clCreateBuffer b");
+        cl_mem x0Buffer = clCreateBuffer(worker.context(), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, biteSize, (void*)x0, &retCode);
+        asyncCheck(retCode, "clCreateBuffer x0");
+        cl_mem x1Buffer = clCreateBuffer(worker.context(), CL_MEM_READ_WRITE, biteSize, 0, &retCode);
+        asyncCheck(retCode, "clCreateBuffer x1");
+        cl_mem normBuffer = clCreateBuffer(worker.context(), CL_MEM_READ_WRITE, biteSize, 0, &retCode);
+        asyncCheck(retCode, "clCreateBuffer norm");
+
+        asyncCheck(clSetKernelArg(kernel, 0, sizeof(cl_mem), &aBuffer), "clSetKernelArg a");
+        asyncCheck(clSetKernelArg(kernel, 1, sizeof(cl_mem), &bBuffer), "clSetKernelArg b");
+        asyncCheck(clSetKernelArg(kernel, 4, sizeof(cl_mem), &normBuffer), "clSetKernelArg norm");
+
+        size_t iter = -1;
+        const size_t nIter = 200;
+        float residual = FLT_MAX;
+        const float tol = 1e-7f;
+
+        auto t0 = std::chrono::steady_clock::now();
+        while (++iter <= nIter && residual > tol) {
+            asyncCheck(clSetKernelArg(kernel, 2, sizeof(cl_mem), &x0Buffer), "clSetKernelArg x0");
+            asyncCheck(clSetKernelArg(kernel, 3, sizeof(cl_mem), &x1Buffer), "clSetKernelArg x1");
+            asyncCheck(clEnqueueNDRangeKernel(queue, kernel, 1, 0, &size, 0, 0, 0, 0), "clEnqueueNDRangeKernel");
+            residual = reduction.nrm2(queue, size, normBuffer, 1);
+
+            std::swap(x0Buffer, x1Buffer);
+        }
+        auto time = std::chrono::steady_clock::now() - t0;
+        asyncCheck(clEnqueueReadBuffer(queue, x0Buffer, CL_TRUE, 0, biteSize, x1, 0, 0, 0), "clEnqueueReadBuffer x");
+
+        clReleaseMemObject(aBuffer);
+        clReleaseMemObject(bBuffer);
+        clReleaseMemObject(x0Buffer);
+        clReleaseMemObject(x1Buffer);
+        clReleaseMemObject(normBuffer);
+
+        return time;
+    });
+}
+
+
+// Matrix-free solvers for the 5-point (2D) and 7-point (3D) Laplacian on a structured grid with
+// zero Dirichlet boundary, A x = b with A = 2 * dimensions on the diagonal and -1 per neighbour.
+// Only b, x0, x1 and a norm vector exist, so memory is O(N) where the dense A takes O(N^2).
+// nz == 1 is a 2D grid; x varies fastest.
+struct StencilGrid {
+    size_t nx, ny, nz;
+
+    size_t size() const { return nx * ny * nz; }
+};
+
+// Red-black Gauss-Seidel updates the points with even x + y + z first, then the odd ones from
+// the new even values; each half-sweep is parallel like a Jacobi sweep and converges about twice
+// as fast.
+enum class StencilMethod { Jacobi, RedBlack };
+
+
+#define STENCIL_TEMPORAL_STEPS 4
+#define STENCIL_BAND_PLANES 16
+#define STENCIL_TILE_2D 16
+#define STENCIL_TILE_3D_XY 8
+#define STENCIL_TILE_3D_Z 4
+
+
+// Updates plane p (a row in 2D, a z-slice in 3D) of a window holding the planes from
+// windowBegin on: every point for color -1, else only the points with (x + y + z) % 2 == color.
+// src and dst may be the same window. Missing neighbour rows and planes are read from `zeros`
+// (nx zeros), which keeps the inner loop free of boundary tests but at its two ends. Returns the
+// sum of squared changes.
+inline float stencilPlane(const StencilGrid& grid, const int p, const int windowBegin, const float *b,
+                          const float *src, float *dst, const int color, const float *zeros) {
+    const bool is3D = grid.nz > 1;
+    const int nx = static_cast<int>(grid.nx);
+    const int rows = is3D ? static_cast<int>(grid.ny) : 1;
+    const int planes = static_cast<int>(is3D ? grid.nz : grid.ny);
+    const size_t planeSize = grid.nx * rows;
+    const float scale = is3D ? 1.0f / 6.0f : 0.25f;
+    const size_t offset = static_cast<size_t>(p - windowBegin) * planeSize;
+    float change = 0.0f;
+
+    for (int r = 0; r < rows; ++r) {
+        const size_t row = offset + static_cast<size_t>(r) * nx;
+        const float *center = src + row;
+        const float *bRow = b + static_cast<size_t>(p) * planeSize + static_cast<size_t>(r) * nx;
+        const float *north = r > 0 ? center - nx : zeros;
+        const float *south = r + 1 < rows ? center + nx : zeros;
+        const float *below = p > 0 ? center - planeSize : zeros;
+        const float *above = p + 1 < planes ? center + planeSize : zeros;
+        float *out = dst + row;
+
+        auto update = [&](const int x, const float left, const float right) {
+            const float value = (bRow[x] + left + right + north[x] + south[x] + below[x] + above[x]) * scale;
+            const float delta = value - center[x];
+            out[x] = value;
+            change += delta * delta;
+        };
+
+        const int first = color < 0 ? 0 : (color + r + p) & 1;
+        const int step = color < 0 ? 1 : 2;
+        int x = first;
+        if (x == 0) {
+            update(0, 0.0f, nx > 1 ? center[1] : 0.0f);
+            x += step;
+        }
+        if (step == 1) {
+            // Jacobi: dst is another window, so the interior vectorizes like jacobiDot.
+            const int end = nx - 1;
+            float interior = 0.0f;
+#if defined(_OPENMP) && _OPENMP >= 201307
+            #pragma omp simd reduction(+:interior)
+#endif
+            for (int i = x; i < end; ++i) {
+                const float value = (bRow[i] + center[i - 1] + center[i + 1] + north[i] + south[i] + below[i] + above[i]) * scale;
+                const float delta = value - center[i];
+                out[i] = value;
+                interior += delta * delta;
+            }
+            change += interior;
+            x = std::max(x, end);
+        }
+        for (; x + 1 < nx; x += step)
+            update(x, center[x - 1], center[x + 1]);
+        if (x == nx - 1)
+            update(x, center[x - 1], 0.0f);
+    }
+
+    return change;
+}
+
+
+// Host counterpart of opencl_stencil_cpu with the same stopping rule, x0/x1 ping-pong and result
+// in x1. Temporal blocking: each thread copies a band of STENCIL_BAND_PLANES planes plus a halo of
+// one plane per stage into a private window, runs STENCIL_TEMPORAL_STEPS sweeps there, shrinking
+// the valid range by a plane per stage, and writes the band back, so x crosses the memory bus once
+// per STENCIL_TEMPORAL_STEPS sweeps. In 2D the window stays in L2; large 3D planes do not fit, and
+// the gain there is from the fused sweeps only. The norm is checked after every
+// STENCIL_TEMPORAL_STEPS sweeps, so the sweep count is rounded up to a multiple of them; sweeps,
+// if given, receives the count actually run.
+auto omp_stencil(const StencilGrid& grid, const StencilMethod method, const float *b, float *x0, float *x1,
+                 const size_t nIter = 200, const float tol = 1e-7f, size_t *sweeps = nullptr) {
+    const bool is3D = grid.nz > 1;
+    const bool redBlack = method == StencilMethod::RedBlack;
+    const int planes = static_cast<int>(is3D ? grid.nz : grid.ny);
+    const size_t planeSize = grid.nx * (is3D ? grid.ny : 1);
+    const int stages = STENCIL_TEMPORAL_STEPS * (redBlack ? 2 : 1);
+    const int lastSweep = stages - (redBlack ? 2 : 1);
+    const int nBands = (planes + STENCIL_BAND_PLANES - 1) / STENCIL_BAND_PLANES;
+    const size_t windowSize = (STENCIL_BAND_PLANES + 2 * stages) * planeSize;
+    HostVector<float> windows(2 * windowSize * omp_get_max_threads()), zeros(grid.nx, 0.0f);
+    float *xOld = x0, *xNew = x1;
+
+    size_t iter = 0;
+    float sum = FLT_MAX;
+
+    auto t0 = std::chrono::steady_clock::now();
+    while (iter < nIter && sqrt(sum) > tol) {
+        sum = 0.0f;
+        int band;
+
+#pragma omp parallel shared(b, xOld, xNew, windows, zeros) private(band) reduction(+:sum)
+        {
+            float *src = windows.data() + 2 * windowSize * omp_get_thread_num();
+            float *dst = src + windowSize;
+
+#pragma omp for schedule(static)
+            for (band = 0; band < nBands; ++band) {
+                const int bandBegin = band * STENCIL_BAND_PLANES;
+                const int bandEnd = std::min(bandBegin + STENCIL_BAND_PLANES, planes);
+                const int windowBegin = std::max(bandBegin - stages, 0);
+                const int windowEnd = std::min(bandEnd + stages, planes);
+                std::copy(xOld + windowBegin * planeSize, xOld + windowEnd * planeSize, src);
+
+                for (int s = 0; s < stages; ++s) {
+                    // Planes at the window edge lack a neighbour, unless the edge is the boundary.
+                    const int first = windowBegin == 0 ? 0 : windowBegin + s + 1;
+                    const int last = windowEnd == planes ? planes : windowEnd - s - 1;
+                    for (int p = first; p < last; ++p) {
+                        const float change = stencilPlane(grid, p, windowBegin, b, src, redBlack ? src : dst,
+                                                          redBlack ? s & 1 : -1, zeros.data());
+                        if (s >= lastSweep && p >= bandBegin && p < bandEnd) sum += change;
+                    }
+                    if (!redBlack) std::swap(src, dst);
+                }
+
+                std::copy(src + (bandBegin - windowBegin) * planeSize, src + (bandEnd - windowBegin) * planeSize,
+                          xNew + bandBegin * planeSize);
+            }
+        }
+
+        iter += STENCIL_TEMPORAL_STEPS;
+        std::swap(xOld, xNew);
+    }
+    auto time = std::chrono::steady_clock::now() - t0;
+
+    if (xOld != x1)
+        std::copy(xOld, xOld + grid.size(), x1);
+    if (sweeps) *sweeps = iter;
+
+    return time;
+}
+
+
+// Sweeps per launch of the device kernels: the most, up to 4 in 2D and 2 in 3D where the halo
+// grows faster, whose tiles fit in the device's local memory. 0 when not even one sweep's fits.
+inline int stencilTemporalSteps(cl_device_id device, const StencilGrid& grid, const StencilMethod method) {
+    cl_ulong localMemory = 0;
+    clGetDeviceInfo(device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(cl_ulong), &localMemory, nullptr);
+
+    const bool redBlack = method == StencilMethod::RedBlack;
+    const size_t arrays = redBlack ? 2 : 3;  // x (twice for Jacobi) and b
+    for (int steps = grid.nz > 1 ? 2 : 4; steps > 0; steps /= 2) {
+        const size_t halo = 2 * steps * (redBlack ? 2 : 1);
+        const size_t points = grid.nz > 1
+            ? (STENCIL_TILE_3D_XY + halo) * (STENCIL_TILE_3D_XY + halo) * (STENCIL_TILE_3D_Z + halo)
+            : (STENCIL_TILE_2D + halo) * (STENCIL_TILE_2D + halo);
+        if (sizeof(float) * arrays * points <= localMemory) return steps;
+    }
+
+    return 0;
+}
+
+
+// Device counterpart of omp_stencil: stencil_2d / stencil_3d run stencilTemporalSteps sweeps per
+// launch on local-memory tiles, and the update norm of the last sweep is reduced on the device.
+// The sweep count is rounded up to a multiple of the steps per launch, as in omp_stencil. A device
+// whose local memory cannot hold even a one-sweep tile gets an error and no sweeps.
+auto opencl_stencil_impl(const StencilGrid& grid, const StencilMethod method, const float *b, float *x0, float *x1,
+                         cl_device_type deviceType, const size_t nIter = 200, const float tol = 1e-7f,
+                         size_t *sweeps = nullptr) {
+    cl_context context;
+    cl_device_id device;
+    cl_command_queue queue;
+    cl_kernel kernel;
+    cl_int retCode = 0;
+    if (sweeps) *sweeps = 0;
+    if (createDeviceContext(deviceType, context, device)) return std::chrono::steady_clock::duration{};
+
+    const int steps = stencilTemporalSteps(device, grid, method);
+    if (!steps) {
+        printf("Error: the stencil tiles do not fit in the device's local memory\n");
+        clReleaseContext(context);
+        return std::chrono::steady_clock::duration{};
+    }
+
+    RET_CODE_RETURN_CHECK(retCode, clCreateCommandQueueWithProperties(context, device, 0, &retCode), queue, "clCreateCommandQueueWithProperties")
+
+    const bool is3D = grid.nz > 1;
+    const std::string options = "-D TEMPORAL_STEPS=" + std::to_string(steps)
+        + (method == StencilMethod::RedBlack ? " -D RED_BLACK" : "")
+        + " -D TILE_2D=" + std::to_string(STENCIL_TILE_2D)
+        + " -D TILE_3D_XY=" + std::to_string(STENCIL_TILE_3D_XY)
+        + " -D TILE_3D_Z=" + std::to_string(STENCIL_TILE_3D_Z);
+    cl_program program = buildProgram(context, device, "stencil_kernel.cl", options.c_str());
+    RET_CODE_RETURN_CHECK(retCode, clCreateKernel(program, is3D ? "stencil_3d" : "stencil_2d", &retCode), kernel, "clCreateKernel")
+
+    const size_t size = grid.size();
+    const size_t biteSize = sizeof(float) * size;
+    cl_mem bBuffer, x0Buffer, x1Buffer, normBuffer;
+    RET_CODE_RETURN_CHECK(retCode, clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, biteSize, (void*)b, &retCode),
+                          bBuffer, "clCreateBuffer b")
+    RET_CODE_RETURN_CHECK(retCode, clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, biteSize, x0, &retCode),
+                          x0Buffer, "clCreateBuffer x0")
+    RET_CODE_RETURN_CHECK(retCode, clCreateBuffer(context, CL_MEM_READ_WRITE, biteSize, 0, &retCode), x1Buffer, "clCreateBuffer x1")
+    RET_CODE_RETURN_CHECK(retCode, clCreateBuffer(context, CL_MEM_READ_WRITE, biteSize, 0, &retCode), normBuffer, "clCreateBuffer norm")
+
+    const cl_uint nx = static_cast<cl_uint>(grid.nx), ny = static_cast<cl_uint>(grid.ny), nz = static_cast<cl_uint>(grid.nz);
+    RET_CODE_CHECK(retCode, clSetKernelArg(kernel, 0, sizeof(cl_uint), &nx), "clSetKernelArg nx")
+    RET_CODE_CHECK(retCode, clSetKernelArg(kernel, 1, sizeof(cl_uint), &ny), "clSetKernelArg ny")
+    RET_CODE_CHECK(retCode, clSetKernelArg(kernel, 2, sizeof(cl_uint), &nz), "clSetKernelArg nz")
+    RET_CODE_CHECK(retCode, clSetKernelArg(kernel, 3, sizeof(cl_mem), &bBuffer), "clSetKernelArg b")
+    RET_CODE_CHECK(retCode, clSetKernelArg(kernel, 6, sizeof(cl_mem), &normBuffer), "clSetKernelArg norm")
+
+    auto roundUp = [](const size_t n, const size_t tile) { return (n + tile - 1) / tile * tile; };
+    const size_t tile = is3D ? STENCIL_TILE_3D_XY : STENCIL_TILE_2D;
+    const size_t nWorkItems[] = {roundUp(grid.nx, tile), roundUp(grid.ny, tile), roundUp(grid.nz, STENCIL_TILE_3D_Z)};
+    const size_t groupSizes[] = {tile, tile, STENCIL_TILE_3D_Z};
+
+    DeviceReduction<float> reduction(context, device);
+
+    size_t iter = 0;
+    float residual = FLT_MAX;
+
+    auto t0 = std::chrono::steady_clock::now();
+    while (iter < nIter && residual > tol) {
+        RET_CODE_CHECK(retCode, clSetKernelArg(kernel, 4, sizeof(cl_mem), &x0Buffer), "clSetKernelArg x0")
+        RET_CODE_CHECK(retCode, clSetKernelArg(kernel, 5, sizeof(cl_mem), &x1Buffer), "clSetKernelArg x1")
+        RET_CODE_CHECK(retCode, clEnqueueNDRangeKernel(queue, kernel, is3D ? 3 : 2, 0, nWorkItems, groupSizes, 0, 0, 0), "clEnqueueNDRangeKernel")
+        residual = reduction.nrm2(queue, size, normBuffer, 1);
+
+        iter += steps;
+        std::swap(x0Buffer, x1Buffer);
+    }
+    auto time = std::chrono::steady_clock::now() - t0;
+    RET_CODE_CHECK(retCode, clEnqueueReadBuffer(queue, x0Buffer, CL_TRUE, 0, biteSize, x1, 0, 0, 0), "clEnqueueReadBuffer x")
+    if (sweeps) *sweeps = iter;
+
+    clReleaseMemObject(bBuffer);
+    clReleaseMemObject(x0Buffer);
+    clReleaseMemObject(x1Buffer);
+    clReleaseMemObject(normBuffer);
+    clReleaseProgram(program);
+    clReleaseKernel(kernel);
+    clReleaseCommandQueue(queue);
+    clReleaseContext(context);
+
+    return time;
+}
+
+
+auto opencl_stencil_cpu(const StencilGrid& grid, const StencilMethod method, const float *b, float *x0, float *x1,
+                        const size_t nIter = 200, const float tol = 1e-7f, size_t *sweeps = nullptr) {
+    return opencl_stencil_impl(grid, method, b, x0, x1, CL_DEVICE_TYPE_CPU, nIter, tol, sweeps);
+}
+
+
+auto opencl_stencil_gpu(const StencilGrid& grid, const StencilMethod method, const float *b, float *x0, float *x1,
+                        const size_t nIter = 200, const float tol = 1e-7f, size_t *sweeps = nullptr) {
+    return opencl_stencil_impl(grid, method, b, x0, x1, CL_DEVICE_TYPE_GPU, nIter, tol, sweeps);
+}
@@ -1,18 +1,35 @@
 #include "jacobi.h"
+#include "embedded_kernels.h"
 
 bool checkMatrix(size_t size, float *a);
 bool checkSolution(size_t size, float *a, float *b, float *x1, float *check);
+void verify_jacobi(Verifier& verifier);
+void verify_stencil(Verifier& verifier);
+void benchmark_stencil(const StencilGrid& grid, const bool hasGPU, TimingBaseline& baseline);
 
 int main() {
+    requestThreadBinding();
+    Verifier verifier;
+    TimingBaseline baseline("jacobi_baseline.json");
+    const bool hasGPU = deviceAvailable(CL_DEVICE_TYPE_GPU);
+
+    std::cout << "Verification:" << std::endl;
+    verify_verifier(verifier);
+    verify_jacobi(verifier);
+    verify_stencil(verifier);
+    std::cout << std::endl;
+
     const size_t size = 1 << 8;
     std::cout << "size = " << size << std::endl;
 
-    float *a     = new float[size * size];
-    float *b     = new float[size];
-    float *x0    = new float[size];
-    float *x1    = new float[size];
-    float *norm  = new float[size];
-    float *check = new float[size];
+    HostBuffer<float> aMemory(size * size), bMemory(size), x0Memory(size), x1Memory(size), normMemory(size), checkMemory(size);
+    float *a     = aMemory.data();
+    float *b     = bMemory.data();
+    float *x0    = x0Memory.data();
+    float *x1    = x1Memory.data();
+    float *norm  = normMemory.data();
+    float *check = checkMemory.data();
+    firstTouch(a, size, size);
 
     for (size_t i = 0; i < size; ++i)
         for (size_t j = 0; j < size; ++j)
@@ -27,19 +44,47 @@ int main() {
         b[i] = (rand() % 5 + 1) / (1.f * size);
 
     // OpenCL GPU
-    auto openCLGPUTime = opencl_jacobi_gpu(size, a, b, x0, x1, norm);
-    std::cout << checkSolution(size, a, b, x1, check) ? "GPU: PASSED\n" : "GPU: FAILED\n";
+    std::fill(x0, x0 + size, 0.0f);
+    decltype(opencl_jacobi_cpu(size, a, b, x0, x1, norm)) openCLGPUTime{};
+    if (hasGPU) {
+        openCLGPUTime = opencl_jacobi_gpu(size, a, b, x0, x1, norm);
+        if (checkSolution(size, a, b, x1, check)) std::cout << "GPU: PASSED\n";
+        else verifier.fail("GPU", "residual above 1e-4");
+    }
 
     // OpenCL CPU
+    std::fill(x0, x0 + size, 0.0f);
     auto openCLCPUTime = opencl_jacobi_cpu(size, a, b, x0, x1, norm);
-    std::cout << checkSolution(size, a, b, x1, check) ? "CPU: PASSED\n" : "CPU: FAILED\n";
+    if (checkSolution(size, a, b, x1, check)) std::cout << "CPU: PASSED\n";
+    else verifier.fail("CPU", "residual above 1e-4");
+
+    // OpenMP
+    std::fill(x0, x0 + size, 0.0f);
+    auto ompTime = omp_jacobi(size, a, b, x0, x1, norm);
+    if (checkSolution(size, a, b, x1, check)) std::cout << "OpenMP: PASSED\n";
+    else verifier.fail("OpenMP", "residual above 1e-4");
 
     // Total OpenCL
     std::cout << "\nTime OpenCL (buffer):\n"
               << "OpenCL GPU " << std::chrono::duration_cast<std::chrono::milliseconds>(openCLGPUTime).count() << " ms\n"
-              << "OpenCL CPU " << std::chrono::duration_cast<std::chrono::milliseconds>(openCLCPUTime).count() << " ms\n";
+              << "OpenCL CPU " << std::chrono::duration_cast<std::chrono::milliseconds>(openCLCPUTime).count() << " ms\n"
+              << "\nTime host:\n"
+              << "OpenMP     " << std::chrono::duration_cast<std::chrono::milliseconds>(ompTime).count() << " ms\n";
+
+    if (hasGPU) baseline.record("opencl_jacobi GPU", openCLGPUTime);
+    baseline.record("opencl_jacobi CPU", openCLCPUTime);
+    baseline.record("omp_jacobi", ompTime);
 
-    return 0;
+    // Matrix-free stencil solvers on grids far beyond what a dense A could hold
+    benchmark_stencil({1024, 1024, 1}, hasGPU, baseline);
+    benchmark_stencil({128, 128, 128}, hasGPU, baseline);
+
+    baseline.compare(verifier);
+    baseline.save();
+
+    std::cout << "\n" << (verifier.failures() ? "FAILED" : "PASSED") << std::endl;
+
+    return verifier.failures() ? 1 : 0;
 }
 
 bool checkMatrix(size_t size, float *a) {
@@ -71,3 +116,173 @@ bool checkSolution(size_t size, float *a, float *b, float *x1, float *check) {
 
     return sqrt(sum) < 1e-4f;
 }
+
+// Every backend against a double-precision Jacobi solution of random diagonally dominant systems,
+// including sizes that are odd or not a multiple of any work-group size.
+void verify_jacobi(Verifier& verifier) {
+    const size_t sizes[] = {1, 37, 256, 301};
+    const double tolerance = 1e-5;
+    const bool hasCPU = deviceAvailable(CL_DEVICE_TYPE_CPU), hasGPU = deviceAvailable(CL_DEVICE_TYPE_GPU);
+
+    ComputeService service(CL_DEVICE_TYPE_CPU, 2);
+    // Specialize from the first call, so the checks cover the KernelJit kernels too; the generic
+    // ones run in the non-shared variants.
+    service.jit().setHotCalls(1);
+
+    for (const size_t size : sizes) {
+        HostVector<float> a(size * size), b(size), x0(size, 0.0f), x1(size), norm(size);
+        fillRandom(a, 7, 0.0, 1.0 / size);
+        fillRandom(b, 8);
+        for (size_t i = 0; i < size; ++i)
+            a[i * size + i] = 2.0f + static_cast<float>(i % 3);
+
+        std::vector<double> reference(size, 0.0), next(size);
+        for (int iter = 0; iter < 1000; ++iter) {
+            double change = 0.0;
+            for (size_t i = 0; i < size; ++i) {
+                double acc = 0.0;
+                for (size_t j = 0; j < size; ++j)
+                    if (j != i) acc += static_cast<double>(a[i * size + j]) * reference[j];
+                next[i] = (b[i] - acc) / a[i * size + i];
+                change = std::max(change, std::fabs(next[i] - reference[i]));
+            }
+            reference.swap(next);
+            if (change < 1e-14) break;
+        }
+
+        const std::string suffix = " (size = " + std::to_string(size) + ")";
+        auto run = [&](const std::string& name, const bool available, auto backend) {
+            if (!available) {
+                verifier.skip(name + suffix, "no device");
+                return;
+            }
+            std::fill(x0.begin(), x0.end(), 0.0f);
+            std::fill(x1.begin(), x1.end(), 0.0f);
+            backend();
+            verifier.check(name + suffix, maxError(size, x1.data(), reference.data()), tolerance);
+        };
+
+        run("omp_jacobi", true, [&]() { omp_jacobi(size, a.data(), b.data(), x0.data(), x1.data(), norm.data()); });
+        run("opencl_jacobi CPU", hasCPU, [&]() { opencl_jacobi_cpu(size, a.data(), b.data(), x0.data(), x1.data(), norm.data()); });
+        run("opencl_jacobi GPU", hasGPU, [&]() { opencl_jacobi_gpu(size, a.data(), b.data(), x0.data(), x1.data(), norm.data()); });
+        run("opencl_jacobi_shared CPU", hasCPU, [&]() { opencl_jacobi_shared(service, size, a.data(), b.data(), x0.data(), x1.data()).wait(); });
+    }
+}
+
+// Double-precision reference for the stencil solvers: `sweeps` plain serial sweeps of the same
+// method, the red points (even x + y + z) before the black ones.
+std::vector<double> referenceStencil(const StencilGrid& grid, const StencilMethod method, const float *b,
+                                     const size_t sweeps) {
+    const size_t nx = grid.nx, ny = grid.ny, nz = grid.nz;
+    const double scale = nz > 1 ? 1.0 / 6.0 : 0.25;
+    std::vector<double> x(grid.size(), 0.0), next(grid.size());
+
+    auto update = [&](const std::vector<double>& from, const size_t i, const size_t j, const size_t k) {
+        const size_t c = (k * ny + j) * nx + i;
+        double acc = b[c];
+        if (i > 0) acc += from[c - 1];
+        if (i + 1 < nx) acc += from[c + 1];
+        if (j > 0) acc += from[c - nx];
+        if (j + 1 < ny) acc += from[c + nx];
+        if (k > 0) acc += from[c - nx * ny];
+        if (k + 1 < nz) acc += from[c + nx * ny];
+        return acc * scale;
+    };
+
+    for (size_t sweep = 0; sweep < sweeps; ++sweep) {
+        if (method == StencilMethod::Jacobi) {
+            for (size_t k = 0; k < nz; ++k)
+                for (size_t j = 0; j < ny; ++j)
+                    for (size_t i = 0; i < nx; ++i)
+                        next[(k * ny + j) * nx + i] = update(x, i, j, k);
+            x.swap(next);
+            continue;
+        }
+        for (size_t color = 0; color < 2; ++color)
+            for (size_t k = 0; k < nz; ++k)
+                for (size_t j = 0; j < ny; ++j)
+                    for (size_t i = (color + j + k) % 2; i < nx; i += 2)
+                        x[(k * ny + j) * nx + i] = update(x, i, j, k);
+    }
+
+    return x;
+}
+
+// Stencil solvers against the reference after a fixed number of sweeps (tolerance 0), on 2D and
+// 3D grids with sides that are odd, smaller than a tile or not a multiple of one, and taller
+// than several host bands so that neighbouring windows overlap.
+void verify_stencil(Verifier& verifier) {
+    const StencilGrid grids[] = {{1, 1, 1}, {17, 5, 1}, {100, 37, 1}, {64, 64, 1}, {5, 7, 3}, {19, 23, 41}, {32, 32, 32}};
+    const StencilMethod methods[] = {StencilMethod::Jacobi, StencilMethod::RedBlack};
+    const size_t sweeps = 40;
+    const double tolerance = 1e-5;
+    const bool hasCPU = deviceAvailable(CL_DEVICE_TYPE_CPU), hasGPU = deviceAvailable(CL_DEVICE_TYPE_GPU);
+
+    for (const StencilGrid& grid : grids) {
+        HostVector<float> b(grid.size()), x0(grid.size()), x1(grid.size());
+        fillRandom(b, 9, 0.0, 1.0);
+
+        for (const StencilMethod method : methods) {
+            const std::vector<double> reference = referenceStencil(grid, method, b.data(), sweeps);
+            const std::string suffix = std::string(method == StencilMethod::Jacobi ? " Jacobi" : " red-black")
+                + " (" + std::to_string(grid.nx) + "x" + std::to_string(grid.ny) + "x" + std::to_string(grid.nz) + ")";
+            auto run = [&](const std::string& name, const bool available, auto backend) {
+                if (!available) {
+                    verifier.skip(name + suffix, "no device");
+                    return;
+                }
+                std::fill(x0.begin(), x0.end(), 0.0f);
+                std::fill(x1.begin(), x1.end(), 0.0f);
+                backend();
+                verifier.check(name + suffix, maxError(grid.size(), x1.data(), reference.data()), tolerance);
+            };
+
+            run("omp_stencil", true, [&]() { omp_stencil(grid, method, b.data(), x0.data(), x1.data(), sweeps, 0.0f); });
+            run("opencl_stencil CPU", hasCPU, [&]() { opencl_stencil_cpu(grid, method, b.data(), x0.data(), x1.data(), sweeps, 0.0f); });
+            run("opencl_stencil GPU", hasGPU, [&]() { opencl_stencil_gpu(grid, method, b.data(), x0.data(), x1.data(), sweeps, 0.0f); });
+        }
+    }
+}
+
+// Poisson problem with unit right-hand side, both methods and all backends, 200 sweeps or until
+// the update norm drops below 1e-7. Prints times and point updates per second over the sweeps
+// each backend actually ran, which differ with its early stop and steps per launch.
+void benchmark_stencil(const StencilGrid& grid, const bool hasGPU, TimingBaseline& baseline) {
+    const size_t size = grid.size();
+    const std::string shape = std::to_string(grid.nx) + "x" + std::to_string(grid.ny)
+        + (grid.nz > 1 ? "x" + std::to_string(grid.nz) : std::string());
+    HostBuffer<float> bMemory(size), x0Memory(size), x1Memory(size);
+    float *b  = bMemory.data();
+    float *x0 = x0Memory.data();
+    float *x1 = x1Memory.data();
+    firstTouch(b, size);
+    firstTouch(x0, size);
+    firstTouch(x1, size);
+    std::fill(b, b + size, 1.0f);
+
+    std::cout << "\nStencil " << shape << " (" << size << " unknowns, "
+              << 3 * sizeof(float) * size / (1 << 20) << " MB; a dense A would take "
+              << sizeof(float) * static_cast<double>(size) * size / (1 << 30) << " GB):\n";
+
+    const StencilMethod methods[] = {StencilMethod::Jacobi, StencilMethod::RedBlack};
+    for (const StencilMethod method : methods) {
+        const std::string name = method == StencilMethod::Jacobi ? "jacobi" : "red-black";
+        size_t sweeps = 0;
+        auto report = [&](const std::string& backend, const std::chrono::steady_clock::duration time) {
+            const double seconds = std::chrono::duration<double>(time).count();
+            std::cout << backend << " " << name << " " << std::chrono::duration_cast<std::chrono::milliseconds>(time).count()
+                      << " ms, " << sweeps << " sweeps, "
+                      << static_cast<double>(sweeps) * size / std::max(seconds, 1e-9) / 1e6 << " Mupdates/s\n";
+            baseline.record(backend + " " + name + " " + shape, time);
+        };
+
+        std::fill(x0, x0 + size, 0.0f);
+        report("omp_stencil", omp_stencil(grid, method, b, x0, x1, 200, 1e-7f, &sweeps));
+        if (hasGPU) {
+            std::fill(x0, x0 + size, 0.0f);
+            report("opencl_stencil GPU", opencl_stencil_gpu(grid, method, b, x0, x1, 200, 1e-7f, &sweeps));
+        }
+        std::fill(x0, x0 + size, 0.0f);
+        report("opencl_stencil CPU", opencl_stencil_cpu(grid, method, b, x0, x1, 200, 1e-7f, &sweeps));
+    }
+}
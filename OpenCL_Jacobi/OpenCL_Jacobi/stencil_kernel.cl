@@ -0,0 +1,180 @@
+// Matrix-free Jacobi and red-black Gauss-Seidel sweeps for the 5-point (2D) and 7-point (3D)
+// Laplacian with zero Dirichlet boundary: x = (b + sum of neighbours) / (2 * dimensions), where
+// neighbours outside the grid count as 0. Build options:
+//   -D TEMPORAL_STEPS=<t>  sweeps per launch
+//   -D RED_BLACK           red-black Gauss-Seidel instead of Jacobi
+//   -D TILE_2D, TILE_3D_XY, TILE_3D_Z  output tile of a work-group, which has one item per point
+//
+// A work-group loads its tile with a halo of HALO points into local memory and runs all sweeps of
+// the launch there, so global memory is read and written once per TEMPORAL_STEPS sweeps. Every
+// stage updates one ring less than the previous one (a stage is a Jacobi sweep or a red or black
+// half-sweep, each of radius 1), and after HALO stages exactly the tile is valid. The halo
+// is recomputed by neighbouring groups, which is the price of not synchronizing between them.
+
+#ifndef TEMPORAL_STEPS
+#define TEMPORAL_STEPS 1
+#endif
+#ifndef TILE_2D
+#define TILE_2D 16
+#endif
+#ifndef TILE_3D_XY
+#define TILE_3D_XY 8
+#endif
+#ifndef TILE_3D_Z
+#define TILE_3D_Z 4
+#endif
+
+#ifdef RED_BLACK
+#define STAGES (2 * TEMPORAL_STEPS)
+#else
+#define STAGES TEMPORAL_STEPS
+#endif
+#define HALO STAGES
+// Stages of the last sweep, before which each item keeps its point's value for the update norm.
+#define LAST_SWEEP (STAGES - STAGES / TEMPORAL_STEPS)
+
+#define L2 (TILE_2D + 2 * HALO)
+#define L3XY (TILE_3D_XY + 2 * HALO)
+#define L3Z (TILE_3D_Z + 2 * HALO)
+
+
+// x and b are nx * ny, row-major. The range is the grid rounded up to TILE_2D x TILE_2D groups.
+__kernel void stencil_2d(const uint nx, const uint ny, const uint nz, __global const float *b,
+                         __global const float *x0, __global float *x1, __global float *norm) {
+    __local float xa[L2 * L2];
+#ifndef RED_BLACK
+    __local float xc[L2 * L2];
+#endif
+    __local float bt[L2 * L2];
+
+    const int lx = get_local_id(0), ly = get_local_id(1);
+    const int originX = (int)get_group_id(0) * TILE_2D - HALO;
+    const int originY = (int)get_group_id(1) * TILE_2D - HALO;
+
+    for (int j = ly; j < L2; j += TILE_2D) {
+        for (int i = lx; i < L2; i += TILE_2D) {
+            const int gx = originX + i, gy = originY + j;
+            const bool inside = gx >= 0 && gx < (int)nx && gy >= 0 && gy < (int)ny;
+            const int c = j * L2 + i;
+            xa[c] = inside ? x0[gy * nx + gx] : 0.0f;
+            bt[c] = inside ? b[gy * nx + gx] : 0.0f;
+#ifndef RED_BLACK
+            xc[c] = xa[c];
+#endif
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    __local float *src = xa;
+#ifdef RED_BLACK
+    __local float *dst = xa;
+#else
+    __local float *dst = xc;
+#endif
+    const int out = (ly + HALO) * L2 + lx + HALO;
+    float previous = 0.0f;
+
+    for (int s = 0; s < STAGES; ++s) {
+        if (s == LAST_SWEEP) previous = src[out];
+
+        for (int j = ly; j < L2; j += TILE_2D) {
+            for (int i = lx; i < L2; i += TILE_2D) {
+                const int gx = originX + i, gy = originY + j;
+                if (i <= s || i >= L2 - 1 - s || j <= s || j >= L2 - 1 - s) continue;
+                if (gx < 0 || gx >= (int)nx || gy < 0 || gy >= (int)ny) continue;
+#ifdef RED_BLACK
+                if (((gx + gy) & 1) != (s & 1)) continue;
+#endif
+                const int c = j * L2 + i;
+                dst[c] = (bt[c] + src[c - 1] + src[c + 1] + src[c - L2] + src[c + L2]) * 0.25f;
+            }
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        __local float *swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    const int gx = originX + lx + HALO, gy = originY + ly + HALO;
+    if (gx < (int)nx && gy < (int)ny) {
+        x1[gy * nx + gx] = src[out];
+        norm[gy * nx + gx] = previous - src[out];
+    }
+}
+
+
+// x and b are nx * ny * nz, x fastest. The range is the grid rounded up to groups of
+// TILE_3D_XY x TILE_3D_XY x TILE_3D_Z.
+__kernel void stencil_3d(const uint nx, const uint ny, const uint nz, __global const float *b,
+                         __global const float *x0, __global float *x1, __global float *norm) {
+    __local float xa[L3Z * L3XY * L3XY];
+#ifndef RED_BLACK
+    __local float xc[L3Z * L3XY * L3XY];
+#endif
+    __local float bt[L3Z * L3XY * L3XY];
+
+    const int lx = get_local_id(0), ly = get_local_id(1), lz = get_local_id(2);
+    const int originX = (int)get_group_id(0) * TILE_3D_XY - HALO;
+    const int originY = (int)get_group_id(1) * TILE_3D_XY - HALO;
+    const int originZ = (int)get_group_id(2) * TILE_3D_Z - HALO;
+    const int planeSize = L3XY * L3XY;
+
+    for (int k = lz; k < L3Z; k += TILE_3D_Z) {
+        for (int j = ly; j < L3XY; j += TILE_3D_XY) {
+            for (int i = lx; i < L3XY; i += TILE_3D_XY) {
+                const int gx = originX + i, gy = originY + j, gz = originZ + k;
+                const bool inside = gx >= 0 && gx < (int)nx && gy >= 0 && gy < (int)ny && gz >= 0 && gz < (int)nz;
+                const size_t g = ((size_t)gz * ny + gy) * nx + gx;
+                const int c = k * planeSize + j * L3XY + i;
+                xa[c] = inside ? x0[g] : 0.0f;
+                bt[c] = inside ? b[g] : 0.0f;
+#ifndef RED_BLACK
+                xc[c] = xa[c];
+#endif
+            }
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    __local float *src = xa;
+#ifdef RED_BLACK
+    __local float *dst = xa;
+#else
+    __local float *dst = xc;
+#endif
+    const int out = (lz + HALO) * planeSize + (ly + HALO) * L3XY + lx + HALO;
+    float previous = 0.0f;
+
+    for (int s = 0; s < STAGES; ++s) {
+        if (s == LAST_SWEEP) previous = src[out];
+
+        for (int k = lz; k < L3Z; k += TILE_3D_Z) {
+            for (int j = ly; j < L3XY; j += TILE_3D_XY) {
+                for (int i = lx; i < L3XY; i += TILE_3D_XY) {
+                    const int gx = originX + i, gy = originY + j, gz = originZ + k;
+                    if (i <= s || i >= L3XY - 1 - s || j <= s || j >= L3XY - 1 - s || k <= s || k >= L3Z - 1 - s) continue;
+                    if (gx < 0 || gx >= (int)nx || gy < 0 || gy >= (int)ny || gz < 0 || gz >= (int)nz) continue;
+#ifdef RED_BLACK
+                    if (((gx + gy + gz) & 1) != (s & 1)) continue;
+#endif
+                    const int c = k * planeSize + j * L3XY + i;
+                    dst[c] = (bt[c] + src[c - 1] + src[c + 1] + src[c - L3XY] + src[c + L3XY]
+                              + src[c - planeSize] + src[c + planeSize]) * (1.0f / 6.0f);
+                }
+            }
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        __local float *swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    const int gx = originX + lx + HALO, gy = originY + ly + HALO, gz = originZ + lz + HALO;
+    if (gx < (int)nx && gy < (int)ny && gz < (int)nz) {
+        const size_t g = ((size_t)gz * ny + gy) * nx + gx;
+        x1[g] = src[out];
+        norm[g] = previous - src[out];
+    }
+}
@@ -0,0 +1,482 @@
+// Generated from the .cl files by OpenCL_Common/embed_kernels.ps1, do not edit.
+#pragma once
+
+#include "../../OpenCL_Common/kernels.h"
+
+static const EmbeddedKernel gemm_batched_kernel_embedded("gemm_batched_kernel.cl",
+    R"CLSRC(#define BLOCK_SIZE 16
+#define GROUP_SIZE 256
+
+// Size class n <= 16: one 256-item work-group holds 256 / (n * n) whole problems in local memory,
+// one work-item per output element.
+__kernel void gemm_batched_small(const uint n, const uint batch,
+                                 __global const float *a, const uint strideA,
+                                 __global const float *b, const uint strideB,
+                                 __global float *c, const uint strideC) {
+    const uint nn = n * n;
+    const uint perGroup = GROUP_SIZE / nn;
+    const uint lid = get_local_id(0);
+    const uint slot = lid / nn;
+    const uint idx = lid % nn;
+    const uint problem = get_group_id(0) * perGroup + slot;
+    const bool active = slot < perGroup && problem < batch;
+
+    __local float Asub[GROUP_SIZE];
+    __local float Bsub[GROUP_SIZE];
+
+    if (active) {
+        Asub[lid] = a[problem * strideA + idx];
+        Bsub[lid] = b[problem * strideB + idx];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (active) {
+        const uint i = idx / n;
+        const uint j = idx % n;
+        const uint base = slot * nn;
+        float result = 0.0f;
+        for (uint k = 0; k < n; ++k)
+            result += Asub[base + i * n + k] * Bsub[base + k * n + j];
+        c[problem * strideC + idx] = result;
+    }
+}
+
+// Size class 16 < n <= 128: one BLOCK_SIZE x BLOCK_SIZE work-group per output tile and problem
+// (third NDRange dimension); tiles past n are zero-filled, so n needs no particular multiple.
+__kernel void gemm_batched_tiled(const uint n, const uint batch,
+                                 __global const float *a, const uint strideA,
+                                 __global const float *b, const uint strideB,
+                                 __global float *c, const uint strideC) {
+    const uint col = get_local_id(0);
+    const uint row = get_local_id(1);
+    const uint globalCol = BLOCK_SIZE * get_group_id(0) + col;
+    const uint globalRow = BLOCK_SIZE * get_group_id(1) + row;
+    const uint problem = get_global_id(2);
+
+    __local float Asub[BLOCK_SIZE][BLOCK_SIZE];
+    __local float Bsub[BLOCK_SIZE][BLOCK_SIZE];
+
+    a += problem * strideA;
+    b += problem * strideB;
+
+    float result = 0.0f;
+    const uint nBlocks = (n + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    for (uint iBlock = 0; iBlock < nBlocks; ++iBlock) {
+        const uint tiledCol = BLOCK_SIZE * iBlock + col;
+        const uint tiledRow = BLOCK_SIZE * iBlock + row;
+        Asub[row][col] = (globalRow < n && tiledCol < n) ? a[globalRow * n + tiledCol] : 0.0f;
+        Bsub[row][col] = (tiledRow < n && globalCol < n) ? b[tiledRow * n + globalCol] : 0.0f;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        for (uint k = 0; k < BLOCK_SIZE; k++) {
+            result += Asub[row][k] * Bsub[k][col];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    if (globalRow < n && globalCol < n)
+        c[problem * strideC + globalRow * n + globalCol] = result;
+}
+)CLSRC"
+);
+
+static const EmbeddedKernel gemm_block_kernel_embedded("gemm_block_kernel.cl",
+    R"CLSRC(#define BLOCK_SIZE 16
+
+// Built with -D N=<n> for a hot size (KernelJit), the tile loop has a constant trip count and, for
+// multiples of BLOCK_SIZE, the bounds checks and zero padding fold away.
+#ifdef N
+#define INSIDE(row, col) (N % BLOCK_SIZE == 0 || ((row) < N && (col) < N))
+#else
+#define INSIDE(row, col) ((row) < n && (col) < n)
+#endif
+
+__kernel void gemm_block(const uint nArg, __global float* a,
+                         __global float* b, __global float* c) {
+#ifdef N
+    const uint n = N;
+#else
+    const uint n = nArg;
+#endif
+    const uint row = get_local_id(0);
+    const uint col = get_local_id(1);
+
+    const uint globalRow = BLOCK_SIZE * get_group_id(0) + row;
+    const uint globalCol = BLOCK_SIZE * get_group_id(1) + col;
+
+    __local float Asub[BLOCK_SIZE][BLOCK_SIZE];
+    __local float Bsub[BLOCK_SIZE][BLOCK_SIZE];
+
+    float result = 0.0f;
+    const uint nBlocks = (n + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    for (uint iBlock = 0; iBlock < nBlocks; ++iBlock) {
+        const uint rowOfBlock = BLOCK_SIZE * iBlock + row;
+        const uint columnOfBlock = BLOCK_SIZE * iBlock + col;
+        Asub[col][row] = INSIDE(globalRow, columnOfBlock) ? a[globalRow * n + columnOfBlock] : 0.0f;
+        Bsub[col][row] = INSIDE(rowOfBlock, globalCol) ? b[rowOfBlock * n + globalCol] : 0.0f;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        for (uint i = 0; i < BLOCK_SIZE; i++) {
+              result += Asub[i][row] * Bsub[col][i];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    if (INSIDE(globalRow, globalCol))
+        c[globalRow * n + globalCol] = result;
+}
+)CLSRC"
+);
+
+static const EmbeddedKernel gemm_block_packed_kernel_embedded("gemm_block_packed_kernel.cl",
+    R"CLSRC(#define BLOCK_SIZE 16
+
+// Same tiling as gemm_block, but b is pre-packed: BLOCK_SIZE x BLOCK_SIZE tiles stored tile-row by
+// tile-row, each tile row-major, so a work-group loads every B tile from one contiguous 1 KB chunk.
+// b is zero-padded to whole tiles, so only the loads of a and the store of c need bounds checks.
+// Built with -D N=<n> for a hot size (KernelJit), the tile loop has a constant trip count and, for
+// multiples of BLOCK_SIZE, the bounds checks fold away.
+#ifdef N
+#define INSIDE(row, col) (N % BLOCK_SIZE == 0 || ((row) < N && (col) < N))
+#else
+#define INSIDE(row, col) ((row) < n && (col) < n)
+#endif
+
+// tiles is PackedMatrix::tiles(), the padded tile count of b per dimension.
+__kernel void gemm_block_packed(const uint nArg, __global const float* a,
+                                __global const float* bPacked, __global float* c, const uint tiles) {
+#ifdef N
+    const uint n = N;
+    const uint nBlocks = (N + BLOCK_SIZE - 1) / BLOCK_SIZE;
+#else
+    const uint n = nArg;
+    const uint nBlocks = tiles;
+#endif
+    const uint row = get_local_id(0);
+    const uint col = get_local_id(1);
+
+    const uint globalRow = BLOCK_SIZE * get_group_id(0) + row;
+    const uint globalCol = BLOCK_SIZE * get_group_id(1) + col;
+
+    __local float Asub[BLOCK_SIZE][BLOCK_SIZE];
+    __local float Bsub[BLOCK_SIZE][BLOCK_SIZE];
+
+    float result = 0.0f;
+
+    for (uint iBlock = 0; iBlock < nBlocks; ++iBlock) {
+        const uint columnOfBlock = BLOCK_SIZE * iBlock + col;
+        __global const float* bTile = bPacked + (iBlock * nBlocks + get_group_id(1)) * BLOCK_SIZE * BLOCK_SIZE;
+        Asub[col][row] = INSIDE(globalRow, columnOfBlock) ? a[globalRow * n + columnOfBlock] : 0.0f;
+        Bsub[col][row] = bTile[row * BLOCK_SIZE + col];
+        barrier(CLK_LOCAL_MEM_FENCE);
+        for (uint i = 0; i < BLOCK_SIZE; i++) {
+              result += Asub[i][row] * Bsub[col][i];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    if (INSIDE(globalRow, globalCol))
+        c[globalRow * n + globalCol] = result;
+}
+)CLSRC"
+);
+
+static const EmbeddedKernel gemm_kernel_embedded("gemm_kernel.cl",
+    R"CLSRC(// Built with -D N=<n> for a hot size (KernelJit), n is a constant and, when the host's range of
+// 16 x 16 groups covers the matrix exactly, the bounds check folds away.
+#ifdef N
+#define INSIDE(row, col) (N % 16 == 0 || ((row) < N && (col) < N))
+#else
+#define INSIDE(row, col) ((row) < n && (col) < n)
+#endif
+
+__kernel void gemm(const uint nArg, __global const float *a,
+                   __global const float *b, __global float *c) {
+#ifdef N
+    const uint n = N;
+#else
+    const uint n = nArg;
+#endif
+    const uint iRow = get_global_id(1);
+    const uint iCol = get_global_id(0);
+
+    if (INSIDE(iRow, iCol)) {
+        float result = 0.0f;
+        for (uint k = 0; k < n; ++k)
+            result += a[iRow * n + k] * b[k * n + iCol];
+        c[iRow * n + iCol] = result;
+    }
+}
+)CLSRC"
+);
+
+static const EmbeddedKernel image_kernel_embedded("image_kernel.cl",
+    R"CLSRC(#define BLOCK_SIZE 16
+
+// The range is n rounded up to whole tiles; reads outside the n x n images load 0 and the items
+// outside them write nothing, since sampler-less image accesses out of range are undefined.
+#define INSIDE(row, col) ((row) < n && (col) < n)
+
+__kernel void matrixMulImg(__write_only image2d_t C, __read_only image2d_t A, __read_only image2d_t B, const int n) {
+    int row = get_local_id(0);
+    int col = get_local_id(1);
+    const int globalRow = BLOCK_SIZE * get_group_id(0) + row;
+    const int globalCol = BLOCK_SIZE * get_group_id(1) + col;
+    local float Asub[BLOCK_SIZE][BLOCK_SIZE];
+    local float Bsub[BLOCK_SIZE][BLOCK_SIZE];
+
+
+    float total = 0.0f;
+    const int numTiles = (n + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    for (int t = 0; t < numTiles; t++) {
+        const int tiledRow = BLOCK_SIZE * t + row;
+        const int tiledCol = BLOCK_SIZE * t + col;
+        const int2 idA = {tiledCol, globalRow};
+        const int2 idB = {globalCol, tiledRow};
+        Asub[col][row] = INSIDE(globalRow, tiledCol) ? read_imagef(A, idA).x : 0.0f;
+        Bsub[col][row] = INSIDE(tiledRow, globalCol) ? read_imagef(B, idB).x : 0.0f;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        for (int k=0; k < BLOCK_SIZE; k++) {
+            total += Asub[k][row] * Bsub[col][k];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+	//if (row == col) printf("%f ", total);
+    const int2 idC = {globalCol, globalRow};
+    if (INSIDE(globalRow, globalCol))
+        write_imagef(C, idC, total);
+}
+)CLSRC"
+);
+
+static const EmbeddedKernel image_rgba_kernel_embedded("image_rgba_kernel.cl",
+    R"CLSRC(// A and B are packed four consecutive columns per CL_RGBA texel, zero-padded to a multiple of 4.
+// Every work-item produces C[row][4 * col4 .. 4 * col4 + 3]: one A texel covers four k, and the
+// four matching B texels each carry four output columns, so no fetched channel is discarded.
+
+__constant sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP | CLK_FILTER_NEAREST;
+
+__kernel void matrixMulImgRGBA(__write_only image2d_t C, __read_only image2d_t A, __read_only image2d_t B,
+                               const uint n) {
+    const int col4 = get_global_id(0);
+    const int row = get_global_id(1);
+    const int width4 = ((int)n + 3) / 4;
+
+    if (col4 >= width4 || row >= (int)n)
+        return;
+
+    float4 total = (float4)(0.0f);
+    for (int k4 = 0; k4 < width4; ++k4) {
+        const float4 a = read_imagef(A, sampler, (int2)(k4, row));
+        const int k = 4 * k4;
+        total += a.x * read_imagef(B, sampler, (int2)(col4, k));
+        total += a.y * read_imagef(B, sampler, (int2)(col4, k + 1));
+        total += a.z * read_imagef(B, sampler, (int2)(col4, k + 2));
+        total += a.w * read_imagef(B, sampler, (int2)(col4, k + 3));
+    }
+    write_imagef(C, (int2)(col4, row), total);
+}
+)CLSRC"
+);
+
+static const EmbeddedKernel reduce_kernel_embedded("reduce_kernel.cl",
+    R"CLSRC(// Two-stage reductions: every work-group of the *_partial kernels reduces a grid-stride slice of
+// the input to one partial, and the *_final kernels, launched as a single work-group, reduce the
+// partials. Build options: -D USE_DOUBLE, -D KAHAN (compensated per-work-item sums) and
+// -D USE_SUBGROUPS (cl_khr_subgroups, OpenCL C 2.0).
+
+#ifdef USE_DOUBLE
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+typedef double real;
+#else
+typedef float real;
+#endif
+
+#ifdef USE_SUBGROUPS
+#pragma OPENCL EXTENSION cl_khr_subgroups : enable
+#endif
+
+
+typedef struct {
+    real sum;
+    real compensation;
+} accumulator;
+
+void accumulate(accumulator *acc, const real value) {
+#ifdef KAHAN
+    const real y = value - acc->compensation;
+    const real t = acc->sum + y;
+    acc->compensation = (t - acc->sum) - y;
+    acc->sum = t;
+#else
+    acc->sum += value;
+#endif
+}
+
+real accumulated(const accumulator acc) {
+    return acc.sum - acc.compensation;
+}
+
+
+// Pairwise tree over `count` entries of scratch; count need not be a power of two.
+real treeReduceSum(__local real *scratch, const uint count) {
+    const uint lid = get_local_id(0);
+    for (uint active = count; active > 1; ) {
+        const uint half = (active + 1) / 2;
+        if (lid < active - half)
+            scratch[lid] += scratch[lid + half];
+        barrier(CLK_LOCAL_MEM_FENCE);
+        active = half;
+    }
+
+    return scratch[0];
+}
+
+real groupReduceSum(real value, __local real *scratch) {
+#ifdef USE_SUBGROUPS
+    value = sub_group_reduce_add(value);
+    if (get_sub_group_local_id() == 0)
+        scratch[get_sub_group_id()] = value;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    const real result = treeReduceSum(scratch, get_num_sub_groups());
+#else
+    scratch[get_local_id(0)] = value;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    const real result = treeReduceSum(scratch, get_local_size(0));
+#endif
+    // scratch may be reused by the caller right away.
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    return result;
+}
+
+
+// (value, index) pairs for iamax: the larger value wins, the smaller index breaks ties, so the
+// result is the first index of the maximum as in BLAS.
+bool better(const real value, const ulong index, const real bestValue, const ulong bestIndex) {
+    return value > bestValue || (value == bestValue && index < bestIndex);
+}
+
+void groupReduceMax(real *value, ulong *index, __local real *scratchValue, __local ulong *scratchIndex) {
+    const uint lid = get_local_id(0);
+#ifdef USE_SUBGROUPS
+    const real subMax = sub_group_reduce_max(*value);
+    const ulong subIndex = sub_group_reduce_min(*value == subMax ? *index : ULONG_MAX);
+    if (get_sub_group_local_id() == 0) {
+        scratchValue[get_sub_group_id()] = subMax;
+        scratchIndex[get_sub_group_id()] = subIndex;
+    }
+    uint active = get_num_sub_groups();
+#else
+    scratchValue[lid] = *value;
+    scratchIndex[lid] = *index;
+    uint active = get_local_size(0);
+#endif
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    while (active > 1) {
+        const uint half = (active + 1) / 2;
+        if (lid < active - half &&
+            better(scratchValue[lid + half], scratchIndex[lid + half], scratchValue[lid], scratchIndex[lid])) {
+            scratchValue[lid] = scratchValue[lid + half];
+            scratchIndex[lid] = scratchIndex[lid + half];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+        active = half;
+    }
+
+    *value = scratchValue[0];
+    *index = scratchIndex[0];
+}
+
+
+__kernel void dot_partial(const ulong count, __global const real *x, const ulong incx, __global const real *y,
+                          const ulong incy, __global real *partial, __local real *scratch) {
+    accumulator acc = {0, 0};
+    for (ulong i = get_global_id(0); i < count; i += get_global_size(0))
+        accumulate(&acc, x[i * incx] * y[i * incy]);
+
+    const real result = groupReduceSum(accumulated(acc), scratch);
+    if (get_local_id(0) == 0)
+        partial[get_group_id(0)] = result;
+}
+
+__kernel void nrm2_partial(const ulong count, __global const real *x, const ulong incx,
+                           __global real *partial, __local real *scratch) {
+    accumulator acc = {0, 0};
+    for (ulong i = get_global_id(0); i < count; i += get_global_size(0))
+        accumulate(&acc, x[i * incx] * x[i * incx]);
+
+    const real result = groupReduceSum(accumulated(acc), scratch);
+    if (get_local_id(0) == 0)
+        partial[get_group_id(0)] = result;
+}
+
+__kernel void asum_partial(const ulong count, __global const real *x, const ulong incx,
+                           __global real *partial, __local real *scratch) {
+    accumulator acc = {0, 0};
+    for (ulong i = get_global_id(0); i < count; i += get_global_size(0))
+        accumulate(&acc, fabs(x[i * incx]));
+
+    const real result = groupReduceSum(accumulated(acc), scratch);
+    if (get_local_id(0) == 0)
+        partial[get_group_id(0)] = result;
+}
+
+__kernel void sum_partial(const ulong count, __global const real *x, const ulong incx,
+                          __global real *partial, __local real *scratch) {
+    accumulator acc = {0, 0};
+    for (ulong i = get_global_id(0); i < count; i += get_global_size(0))
+        accumulate(&acc, x[i * incx]);
+
+    const real result = groupReduceSum(accumulated(acc), scratch);
+    if (get_local_id(0) == 0)
+        partial[get_group_id(0)] = result;
+}
+
+__kernel void sum_final(const ulong count, __global const real *partial, __global real *result,
+                        __local real *scratch) {
+    accumulator acc = {0, 0};
+    for (ulong i = get_local_id(0); i < count; i += get_local_size(0))
+        accumulate(&acc, partial[i]);
+
+    const real total = groupReduceSum(accumulated(acc), scratch);
+    if (get_local_id(0) == 0)
+        result[0] = total;
+}
+
+
+__kernel void iamax_partial(const ulong count, __global const real *x, const ulong incx,
+                            __global real *partialValue, __global ulong *partialIndex,
+                            __local real *scratchValue, __local ulong *scratchIndex) {
+    real bestValue = -1;
+    ulong bestIndex = ULONG_MAX;
+    for (ulong i = get_global_id(0); i < count; i += get_global_size(0)) {
+        const real value = fabs(x[i * incx]);
+        if (better(value, i, bestValue, bestIndex)) {
+            bestValue = value;
+            bestIndex = i;
+        }
+    }
+
+    groupReduceMax(&bestValue, &bestIndex, scratchValue, scratchIndex);
+    if (get_local_id(0) == 0) {
+        partialValue[get_group_id(0)] = bestValue;
+        partialIndex[get_group_id(0)] = bestIndex;
+    }
+}
+
+__kernel void iamax_final(const ulong count, __global const real *partialValue, __global const ulong *partialIndex,
+                          __global ulong *result, __local real *scratchValue, __local ulong *scratchIndex) {
+    real bestValue = -1;
+    ulong bestIndex = ULONG_MAX;
+    for (ulong i = get_local_id(0); i < count; i += get_local_size(0)) {
+        if (better(partialValue[i], partialIndex[i], bestValue, bestIndex)) {
+            bestValue = partialValue[i];
+            bestIndex = partialIndex[i];
+        }
+    }
+
+    groupReduceMax(&bestValue, &bestIndex, scratchValue, scratchIndex);
+    if (get_local_id(0) == 0)
+        result[0] = bestIndex;
+}
+)CLSRC"
+);
@@ -5,6 +5,15 @@
 #include <fstream>
 #include <chrono>
 #include <algorithm>
+#include <vector>
+#include <cmath>
+
+#include "../../OpenCL_Common/async.h"
+#include "../../OpenCL_Common/service.h"
+#include "../../OpenCL_Common/kernels.h"
+#include "../../OpenCL_Common/memory.h"
+#include "../../OpenCL_Common/perf.h"
+#include "../../OpenCL_Common/verify.h"
 
 
 #define RET_CODE_CHECK(retCode, func, message)                                             \
@@ -27,7 +36,7 @@ auto omp_gemm(const cl_uint n, const float *a, const float *b, float *c) {
     int i, j, k;
     float c_ij;
     auto t0 = std::chrono::steady_clock::now();
-#pragma omp parallel for shared (n, a, b, c) private(i, j, k, c_ij)
+#pragma omp parallel for schedule(static) shared (n, a, b, c) private(i, j, k, c_ij)
     for (i = 0; i < n; ++i) {
         for (j = 0; j < n; ++j) {
             c_ij = 0.0f;
@@ -76,11 +85,194 @@ auto omp_gemm_block(const cl_uint n, const float *a, const float *b, float *c) {
 }
 
 
-std::string readKernel(const char *filename) {
-    std::ifstream ifs(filename);
-    std::string content{ std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>() };
+void gemmSmall(const cl_uint n, const float *a, const float *b, float *c) {
+    for (cl_uint i = 0; i < n; ++i) {
+        float *cRow = c + i * n;
+        for (cl_uint j = 0; j < n; ++j)
+            cRow[j] = 0.0f;
+        for (cl_uint k = 0; k < n; ++k) {
+            const float aik = a[i * n + k];
+            const float *bRow = b + k * n;
+            for (cl_uint j = 0; j < n; ++j)
+                cRow[j] += aik * bRow[j];
+        }
+    }
+}
+
+
+// batch independent n x n products; problem p uses a + p * strideA, b + p * strideB, c + p * strideC.
+// Parallel over the batch rather than inside each matrix, which is too small to split.
+auto omp_gemm_strided_batched(const cl_uint n, const cl_uint batch, const float *a, const cl_uint strideA,
+                              const float *b, const cl_uint strideB, float *c, const cl_uint strideC) {
+    int p;
+    auto t0 = std::chrono::steady_clock::now();
+#pragma omp parallel for schedule(static) shared(n, batch, a, b, c, strideA, strideB, strideC) private(p)
+    for (p = 0; p < static_cast<int>(batch); ++p)
+        gemmSmall(n, a + static_cast<size_t>(p) * strideA, b + static_cast<size_t>(p) * strideB,
+                  c + static_cast<size_t>(p) * strideC);
+
+    return std::chrono::steady_clock::now() - t0;
+}
+
+
+auto omp_gemm_batched(const cl_uint n, const cl_uint batch, const float *const *a, const float *const *b, float *const *c) {
+    int p;
+    auto t0 = std::chrono::steady_clock::now();
+#pragma omp parallel for schedule(static) shared(n, batch, a, b, c) private(p)
+    for (p = 0; p < static_cast<int>(batch); ++p)
+        gemmSmall(n, a[p], b[p], c[p]);
+
+    return std::chrono::steady_clock::now() - t0;
+}
+
+// Bump allocator for the Strassen temporaries: one allocation up front, every recursion level
+// takes its slices on entry and gives them back on exit.
+class StrassenArena {
+public:
+    explicit StrassenArena(const size_t size) : data_(size) {}
+
+    float *allocate(const size_t count) {
+        float *result = data_.data() + top_;
+        top_ += count;
+        return result;
+    }
+
+    size_t mark() const { return top_; }
+    void release(const size_t mark) { top_ = mark; }
+
+private:
+    HostVector<float> data_;
+    size_t top_ = 0;
+};
+
+
+// z = x + sign * y on h x h views with leading dimensions.
+void strassenAdd(const cl_uint h, const float *x, const cl_uint ldx, const float *y, const cl_uint ldy,
+                 float *z, const cl_uint ldz, const float sign = 1.0f) {
+    int i;
+#pragma omp parallel for shared(h, x, y, z, ldx, ldy, ldz, sign) private(i)
+    for (i = 0; i < static_cast<int>(h); ++i)
+        for (cl_uint j = 0; j < h; ++j)
+            z[i * ldz + j] = x[i * ldx + j] + sign * y[i * ldy + j];
+}
 
-    return content;
+
+void strassenCopy(const cl_uint h, const float *x, const cl_uint ldx, float *z, const cl_uint ldz) {
+    for (cl_uint i = 0; i < h; ++i)
+        std::copy(x + i * ldx, x + i * ldx + h, z + i * ldz);
+}
+
+
+size_t strassenWorkspace(const cl_uint n, const cl_uint cutoff) {
+    if (n <= cutoff || n % 2) return 3 * static_cast<size_t>(n) * n;
+    const size_t h = n / 2;
+    return 15 * h * h + strassenWorkspace(n / 2, cutoff);
+}
+
+
+// Strassen-Winograd step: 7 half-size products and 15 additions instead of 8 products.
+template <typename BaseGemm>
+void strassenRecursive(const cl_uint n, const float *a, const cl_uint lda, const float *b, const cl_uint ldb,
+                       float *c, const cl_uint ldc, const cl_uint cutoff, StrassenArena& arena, BaseGemm& baseGemm) {
+    const size_t mark = arena.mark();
+
+    if (n <= cutoff || n % 2) {
+        const size_t nn = static_cast<size_t>(n) * n;
+        float *aLeaf = arena.allocate(nn), *bLeaf = arena.allocate(nn), *cLeaf = arena.allocate(nn);
+        strassenCopy(n, a, lda, aLeaf, n);
+        strassenCopy(n, b, ldb, bLeaf, n);
+        baseGemm(n, aLeaf, bLeaf, cLeaf);
+        strassenCopy(n, cLeaf, n, c, ldc);
+        arena.release(mark);
+        return;
+    }
+
+    const cl_uint h = n / 2;
+    const size_t hh = static_cast<size_t>(h) * h;
+    const float *a11 = a, *a12 = a + h, *a21 = a + h * lda, *a22 = a + h * lda + h;
+    const float *b11 = b, *b12 = b + h, *b21 = b + h * ldb, *b22 = b + h * ldb + h;
+    float *c11 = c, *c12 = c + h, *c21 = c + h * ldc, *c22 = c + h * ldc + h;
+
+    float *s[4], *t[4], *mm[7];
+    for (auto& p : s)  p = arena.allocate(hh);
+    for (auto& p : t)  p = arena.allocate(hh);
+    for (auto& p : mm) p = arena.allocate(hh);
+
+    strassenAdd(h, a21, lda, a22, lda, s[0], h);
+    strassenAdd(h, s[0], h, a11, lda, s[1], h, -1.0f);
+    strassenAdd(h, a11, lda, a21, lda, s[2], h, -1.0f);
+    strassenAdd(h, a12, lda, s[1], h, s[3], h, -1.0f);
+    strassenAdd(h, b12, ldb, b11, ldb, t[0], h, -1.0f);
+    strassenAdd(h, b22, ldb, t[0], h, t[1], h, -1.0f);
+    strassenAdd(h, b22, ldb, b12, ldb, t[2], h, -1.0f);
+    strassenAdd(h, t[1], h, b21, ldb, t[3], h, -1.0f);
+
+    strassenRecursive(h, a11, lda, b11, ldb, mm[0], h, cutoff, arena, baseGemm);
+    strassenRecursive(h, a12, lda, b21, ldb, mm[1], h, cutoff, arena, baseGemm);
+    strassenRecursive(h, s[3], h, b22, ldb, mm[2], h, cutoff, arena, baseGemm);
+    strassenRecursive(h, a22, lda, t[3], h, mm[3], h, cutoff, arena, baseGemm);
+    strassenRecursive(h, s[0], h, t[0], h, mm[4], h, cutoff, arena, baseGemm);
+    strassenRecursive(h, s[1], h, t[1], h, mm[5], h, cutoff, arena, baseGemm);
+    strassenRecursive(h, s[2], h, t[2], h, mm[6], h, cutoff, arena, baseGemm);
+
+    // U2 = M1 + M6 goes to c12, U3 = U2 + M7 to c21, then c12 becomes U4 = U2 + M5 and U5 = U4 + M3.
+    strassenAdd(h, mm[0], h, mm[1], h, c11, ldc);
+    strassenAdd(h, mm[0], h, mm[5], h, c12, ldc);
+    strassenAdd(h, c12, ldc, mm[6], h, c21, ldc);
+    strassenAdd(h, c12, ldc, mm[4], h, c12, ldc);
+    strassenAdd(h, c12, ldc, mm[2], h, c12, ldc);
+    strassenAdd(h, c21, ldc, mm[4], h, c22, ldc);
+    strassenAdd(h, c21, ldc, mm[3], h, c21, ldc, -1.0f);
+
+    arena.release(mark);
+}
+
+
+// c = a * b through Strassen-Winograd recursion until the size drops to cutoff, where baseGemm
+// (any n, a, b, c routine computing c = a * b on contiguous matrices) takes over. n is zero-padded
+// to cutoffLeaf * 2^levels so that every level splits evenly. Each level adds a little rounding
+// error, so a larger cutoff trades speed for accuracy. A cutoff of 0 counts as 1.
+template <typename BaseGemm>
+auto strassen_gemm(const cl_uint n, const float *a, const float *b, float *c, cl_uint cutoff, BaseGemm baseGemm) {
+    auto t0 = std::chrono::steady_clock::now();
+
+    cutoff = std::max<cl_uint>(cutoff, 1);
+
+    cl_uint levels = 0, leaf = n;
+    while (leaf > cutoff) {
+        leaf = (leaf + 1) / 2;
+        ++levels;
+    }
+    const cl_uint nPadded = leaf << levels;
+    const size_t nnPadded = static_cast<size_t>(nPadded) * nPadded;
+
+    StrassenArena arena(strassenWorkspace(nPadded, cutoff) + (nPadded != n ? 3 * nnPadded : 0));
+    if (nPadded == n) {
+        strassenRecursive(n, a, n, b, n, c, n, cutoff, arena, baseGemm);
+    }
+    else {
+        float *aPadded = arena.allocate(nnPadded), *bPadded = arena.allocate(nnPadded), *cPadded = arena.allocate(nnPadded);
+        std::fill(aPadded, aPadded + nnPadded, 0.0f);
+        std::fill(bPadded, bPadded + nnPadded, 0.0f);
+        strassenCopy(n, a, n, aPadded, nPadded);
+        strassenCopy(n, b, n, bPadded, nPadded);
+        strassenRecursive(nPadded, aPadded, nPadded, bPadded, nPadded, cPadded, nPadded, cutoff, arena, baseGemm);
+        strassenCopy(n, cPadded, nPadded, c, n);
+    }
+
+    return std::chrono::steady_clock::now() - t0;
+}
+
+
+auto strassen_gemm_block(const cl_uint n, const float *a, const float *b, float *c, const cl_uint cutoff = 256) {
+    return strassen_gemm(n, a, b, c, cutoff, [](const cl_uint m, const float *x, const float *y, float *z) {
+        std::fill(z, z + static_cast<size_t>(m) * m, 0.0f);
+        omp_gemm_block(m, x, y, z);
+    });
+}
+
+std::string readKernel(const char *filename) {
+    return kernelSource(filename);
 }
 
 
@@ -193,6 +385,9 @@ void setKernelArguments<true>(const cl_uint n, const float *a, const float *b, f
     RET_CODE_RETURN_CHECK(retCode, clCreateImage(context, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR,
                           &imgFormat, &imgDesc, c, &retCode), cBuffer, "clCreateImage c")
     RET_CODE_CHECK(retCode, clSetKernelArg(kernel, 0, sizeof(cl_mem), &cBuffer), "clSetKernelArg c")
+
+    const cl_int size = static_cast<cl_int>(n);
+    RET_CODE_CHECK(retCode, clSetKernelArg(kernel, 3, sizeof(cl_int), &size), "clSetKernelArg n")
 }
 
 
@@ -212,7 +407,8 @@ auto opencl_gemm_impl(const cl_uint n, const float *a, const float *b, float *c,
     else          setKernelArguments<false>(n, a, b, c, kernel, context, queue, device, retCode, aBuffer, bBuffer, cBuffer);
 
     cl_event event;
-    const size_t nWorkItems[] = {n, n};
+    const size_t nRounded = (n + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+    const size_t nWorkItems[] = {nRounded, nRounded};
     const size_t groupSizes[] = {BLOCK_SIZE, BLOCK_SIZE};
 
     auto t0 = std::chrono::steady_clock::now();
@@ -269,3 +465,410 @@ auto opencl_gemm_cpu_image(const cl_uint n, const float *a, const float *b, floa
 auto opencl_gemm_gpu_image(const cl_uint n, const float *a, const float *b, float *c) {
     return opencl_gemm_impl(n, a, b, c, "image_kernel.cl", "matrixMulImg", CL_DEVICE_TYPE_GPU, true);
 }
+
+
+// All problems of the batch in a single launch: gemm_batched_small for n <= 16, where several
+// problems share one work-group, and gemm_batched_tiled above that.
+auto opencl_gemm_strided_batched_impl(const cl_uint n, const cl_uint batch, const float *a, const cl_uint strideA,
+                                      const float *b, const cl_uint strideB, float *c, const cl_uint strideC,
+                                      cl_device_type deviceType) {
+    // Nothing to multiply, and the buffer sizes and work-items per group below need both non-zero.
+    if (batch == 0 || n == 0) return std::chrono::steady_clock::duration{};
+
+    cl_context context;
+    cl_command_queue queue;
+    cl_kernel kernel;
+    cl_device_id device;
+    cl_program program;
+    cl_mem aBuffer, bBuffer, cBuffer;
+    cl_int retCode = 0;
+
+    const bool small = n * n <= 256;
+    initializeKernel(kernel, context, queue, device, program, retCode, "gemm_batched_kernel.cl",
+                     small ? "gemm_batched_small" : "gemm_batched_tiled", deviceType);
+
+    const size_t biteSizeA = sizeof(float) * (static_cast<size_t>(strideA) * (batch - 1) + n * n);
+    const size_t biteSizeB = sizeof(float) * (static_cast<size_t>(strideB) * (batch - 1) + n * n);
+    const size_t biteSizeC = sizeof(float) * (static_cast<size_t>(strideC) * (batch - 1) + n * n);
+
+    RET_CODE_RETURN_CHECK(retCode, clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, biteSizeA, (void*)a, &retCode), aBuffer, "clCreateBuffer a")
+    RET_CODE_RETURN_CHECK(retCode, clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, biteSizeB, (void*)b, &retCode), bBuffer, "clCreateBuffer b")
+    RET_CODE_RETURN_CHECK(retCode, clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, biteSizeC, c, &retCode), cBuffer, "clCreateBuffer c")
+
+    RET_CODE_CHECK(retCode, clSetKernelArg(kernel, 0, sizeof(cl_uint), &n), "clSetKernelArg n")
+    RET_CODE_CHECK(retCode, clSetKernelArg(kernel, 1, sizeof(cl_uint), &batch), "clSetKernelArg batch")
+    RET_CODE_CHECK(retCode, clSetKernelArg(kernel, 2, sizeof(cl_mem), &aBuffer), "clSetKernelArg a")
+    RET_CODE_CHECK(retCode, clSetKernelArg(kernel, 3, sizeof(cl_uint), &strideA), "clSetKernelArg strideA")
+    RET_CODE_CHECK(retCode, clSetKernelArg(kernel, 4, sizeof(cl_mem), &bBuffer), "clSetKernelArg b")
+    RET_CODE_CHECK(retCode, clSetKernelArg(kernel, 5, sizeof(cl_uint), &strideB), "clSetKernelArg strideB")
+    RET_CODE_CHECK(retCode, clSetKernelArg(kernel, 6, sizeof(cl_mem), &cBuffer), "clSetKernelArg c")
+    RET_CODE_CHECK(retCode, clSetKernelArg(kernel, 7, sizeof(cl_uint), &strideC), "clSetKernelArg strideC")
+
+    cl_event event;
+    const cl_uint perGroup = small ? 256 / (n * n) : 1;
+    const cl_uint tiles = (n + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    const size_t smallWorkItems[] = {static_cast<size_t>((batch + perGroup - 1) / perGroup) * 256};
+    const size_t smallGroupSizes[] = {256};
+    const size_t tiledWorkItems[] = {tiles * BLOCK_SIZE, tiles * BLOCK_SIZE, batch};
+    const size_t tiledGroupSizes[] = {BLOCK_SIZE, BLOCK_SIZE, 1};
+
+    auto t0 = std::chrono::steady_clock::now();
+    if (small) {
+        RET_CODE_CHECK(retCode, clEnqueueNDRangeKernel(queue, kernel, 1, 0, smallWorkItems, smallGroupSizes, 0, 0, &event), "clEnqueueNDRangeKernel")
+    }
+    else {
+        RET_CODE_CHECK(retCode, clEnqueueNDRangeKernel(queue, kernel, 3, 0, tiledWorkItems, tiledGroupSizes, 0, 0, &event), "clEnqueueNDRangeKernel")
+    }
+    clWaitForEvents(1, &event);
+    auto time = std::chrono::steady_clock::now() - t0;
+
+    RET_CODE_CHECK(retCode, clEnqueueReadBuffer(queue, cBuffer, CL_TRUE, 0, biteSizeC, c, 0, 0, 0), "clEnqueueReadBuffer")
+
+    clReleaseMemObject(aBuffer);
+    clReleaseMemObject(bBuffer);
+    clReleaseMemObject(cBuffer);
+    clReleaseProgram(program);
+    clReleaseKernel(kernel);
+    clReleaseCommandQueue(queue);
+    clReleaseContext(context);
+
+    return time;
+}
+
+
+// Pointer-array batch: gathered into one contiguous strided batch, launched once, scattered back.
+auto opencl_gemm_batched_impl(const cl_uint n, const cl_uint batch, const float *const *a, const float *const *b,
+                              float *const *c, cl_device_type deviceType) {
+    const size_t nn = static_cast<size_t>(n) * n;
+    HostVector<float> aPacked(nn * batch), bPacked(nn * batch), cPacked(nn * batch);
+    for (cl_uint p = 0; p < batch; ++p) {
+        std::copy(a[p], a[p] + nn, aPacked.begin() + p * nn);
+        std::copy(b[p], b[p] + nn, bPacked.begin() + p * nn);
+    }
+
+    auto time = opencl_gemm_strided_batched_impl(n, batch, aPacked.data(), n * n, bPacked.data(), n * n,
+                                                 cPacked.data(), n * n, deviceType);
+
+    for (cl_uint p = 0; p < batch; ++p)
+        std::copy(cPacked.begin() + p * nn, cPacked.begin() + (p + 1) * nn, c[p]);
+
+    return time;
+}
+
+
+auto opencl_gemm_strided_batched_cpu(const cl_uint n, const cl_uint batch, const float *a, const cl_uint strideA,
+                                     const float *b, const cl_uint strideB, float *c, const cl_uint strideC) {
+    return opencl_gemm_strided_batched_impl(n, batch, a, strideA, b, strideB, c, strideC, CL_DEVICE_TYPE_CPU);
+}
+
+
+auto opencl_gemm_strided_batched_gpu(const cl_uint n, const cl_uint batch, const float *a, const cl_uint strideA,
+                                     const float *b, const cl_uint strideB, float *c, const cl_uint strideC) {
+    return opencl_gemm_strided_batched_impl(n, batch, a, strideA, b, strideB, c, strideC, CL_DEVICE_TYPE_GPU);
+}
+
+
+auto opencl_gemm_batched_cpu(const cl_uint n, const cl_uint batch, const float *const *a, const float *const *b, float *const *c) {
+    return opencl_gemm_batched_impl(n, batch, a, b, c, CL_DEVICE_TYPE_CPU);
+}
+
+
+auto opencl_gemm_batched_gpu(const cl_uint n, const cl_uint batch, const float *const *a, const float *const *b, float *const *c) {
+    return opencl_gemm_batched_impl(n, batch, a, b, c, CL_DEVICE_TYPE_GPU);
+}
+
+// Packs four consecutive columns of a row-major n x n matrix into one CL_RGBA texel; the last
+// texel of every row is zero-padded when n is not a multiple of 4.
+HostVector<float> packRGBA(const cl_uint n, const float *matrix) {
+    const cl_uint width4 = (n + 3) / 4;
+    HostVector<float> packed(4 * width4 * n, 0.0f);
+    for (cl_uint i = 0; i < n; ++i)
+        std::copy(matrix + i * n, matrix + (i + 1) * n, packed.begin() + 4 * width4 * i);
+
+    return packed;
+}
+
+
+void unpackRGBA(const cl_uint n, const HostVector<float>& packed, float *matrix) {
+    const cl_uint width4 = (n + 3) / 4;
+    for (cl_uint i = 0; i < n; ++i)
+        std::copy(packed.begin() + 4 * width4 * i, packed.begin() + 4 * width4 * i + n, matrix + i * n);
+}
+
+
+auto opencl_gemm_image_rgba_impl(const cl_uint n, const float *a, const float *b, float *c, cl_device_type deviceType) {
+    cl_context context;
+    cl_command_queue queue;
+    cl_kernel kernel;
+    cl_device_id device;
+    cl_program program;
+    cl_mem aImage, bImage, cImage;
+    cl_int retCode = 0;
+
+    initializeKernel(kernel, context, queue, device, program, retCode, "image_rgba_kernel.cl", "matrixMulImgRGBA", deviceType);
+
+    const cl_uint width4 = (n + 3) / 4;
+    HostVector<float> aPacked = packRGBA(n, a), bPacked = packRGBA(n, b), cPacked(4 * width4 * n);
+
+    cl_image_format imgFormat = {CL_RGBA, CL_FLOAT};
+    cl_image_desc imgDesc = {CL_MEM_OBJECT_IMAGE2D, width4, n, 1, 1, 0, 0, 0, 0, 0};
+
+    RET_CODE_RETURN_CHECK(retCode, clCreateImage(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                          &imgFormat, &imgDesc, aPacked.data(), &retCode), aImage, "clCreateImage a")
+    RET_CODE_RETURN_CHECK(retCode, clCreateImage(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                          &imgFormat, &imgDesc, bPacked.data(), &retCode), bImage, "clCreateImage b")
+    RET_CODE_RETURN_CHECK(retCode, clCreateImage(context, CL_MEM_WRITE_ONLY,
+                          &imgFormat, &imgDesc, nullptr, &retCode), cImage, "clCreateImage c")
+
+    RET_CODE_CHECK(retCode, clSetKernelArg(kernel, 0, sizeof(cl_mem), &cImage), "clSetKernelArg c")
+    RET_CODE_CHECK(retCode, clSetKernelArg(kernel, 1, sizeof(cl_mem), &aImage), "clSetKernelArg a")
+    RET_CODE_CHECK(retCode, clSetKernelArg(kernel, 2, sizeof(cl_mem), &bImage), "clSetKernelArg b")
+    RET_CODE_CHECK(retCode, clSetKernelArg(kernel, 3, sizeof(cl_uint), &n), "clSetKernelArg n")
+
+    cl_event event;
+    const size_t nWorkItems[] = {width4, n};
+
+    auto t0 = std::chrono::steady_clock::now();
+    RET_CODE_CHECK(retCode, clEnqueueNDRangeKernel(queue, kernel, 2, 0, nWorkItems, 0, 0, 0, &event), "clEnqueueNDRangeKernel")
+    clWaitForEvents(1, &event);
+    auto time = std::chrono::steady_clock::now() - t0;
+
+    const size_t origin[] = {0, 0, 0};
+    const size_t region[] = {width4, n, 1};
+    RET_CODE_CHECK(retCode, clEnqueueReadImage(queue, cImage, CL_TRUE, origin, region, 0, 0, cPacked.data(), 0, 0, 0), "clEnqueueReadImage")
+    unpackRGBA(n, cPacked, c);
+
+    clReleaseMemObject(aImage);
+    clReleaseMemObject(bImage);
+    clReleaseMemObject(cImage);
+    clReleaseProgram(program);
+    clReleaseKernel(kernel);
+    clReleaseCommandQueue(queue);
+    clReleaseContext(context);
+
+    return time;
+}
+
+
+auto opencl_gemm_cpu_image_rgba(const cl_uint n, const float *a, const float *b, float *c) {
+    return opencl_gemm_image_rgba_impl(n, a, b, c, CL_DEVICE_TYPE_CPU);
+}
+
+
+auto opencl_gemm_gpu_image_rgba(const cl_uint n, const float *a, const float *b, float *c) {
+    return opencl_gemm_image_rgba_impl(n, a, b, c, CL_DEVICE_TYPE_GPU);
+}
+
+// Enqueues upload, launch and read-back without blocking; c holds the result once the returned
+// event completes, and a, b, c must stay alive until then. Independent calls overlap on the device.
+AsyncEvent opencl_gemm_async(AsyncScheduler& scheduler, const cl_uint n, const float *a, const float *b, float *c,
+                             const char *filename, const char *kernelName) {
+    if (!scheduler.valid()) return AsyncEvent();
+
+    const size_t biteSize = sizeof(float) * n * n;
+    cl_kernel kernel = scheduler.kernel(filename, kernelName);
+
+    AsyncBuffer aBuffer = scheduler.createBuffer(CL_MEM_READ_ONLY, biteSize);
+    AsyncBuffer bBuffer = scheduler.createBuffer(CL_MEM_READ_ONLY, biteSize);
+    AsyncBuffer cBuffer = scheduler.createBuffer(CL_MEM_WRITE_ONLY, biteSize);
+    scheduler.write(aBuffer, a, biteSize);
+    scheduler.write(bBuffer, b, biteSize);
+
+    asyncCheck(clSetKernelArg(kernel, 0, sizeof(cl_uint), &n), "clSetKernelArg n");
+    asyncCheck(clSetKernelArg(kernel, 1, sizeof(cl_mem), aBuffer.memPtr()), "clSetKernelArg a");
+    asyncCheck(clSetKernelArg(kernel, 2, sizeof(cl_mem), bBuffer.memPtr()), "clSetKernelArg b");
+    asyncCheck(clSetKernelArg(kernel, 3, sizeof(cl_mem), cBuffer.memPtr()), "clSetKernelArg c");
+
+    const size_t nRounded = (n + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+    const size_t nWorkItems[] = {nRounded, nRounded};
+    const size_t groupSizes[] = {BLOCK_SIZE, BLOCK_SIZE};
+    scheduler.launch(kernel, 2, nWorkItems, groupSizes, {&aBuffer, &bBuffer}, {&cBuffer});
+
+    return scheduler.read(cBuffer, c, biteSize);
+}
+
+
+// Thread-safe variant of opencl_gemm_impl: runs on one of the service's dispatcher threads with
+// the shared context and program, so concurrent callers neither create contexts nor rebuild.
+// A hot n runs the kernel specialized for it.
+std::future<ComputeService::Duration> opencl_gemm_shared(ComputeService& service, const cl_uint n, const float *a,
+                                                         const float *b, float *c, const char *filename,
+                                                         const char *kernelName) {
+    return service.submit([=](ServiceWorker& worker) {
+        cl_int retCode = 0;
+        const size_t biteSize = sizeof(float) * n * n;
+        cl_kernel kernel = worker.specializedKernel(filename, kernelName, shapeOptions({{"N", n}}));
+        cl_command_queue queue = worker.queue();
+
+        cl_mem aBuffer = clCreateBuffer(worker.context(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, biteSize, (void*)a, &retCode);
+        asyncCheck(retCode, "clCreateBuffer a");
+        cl_mem bBuffer = clCreateBuffer(worker.context(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, biteSize, (void*)b, &retCode);
+        asyncCheck(retCode, "clCreateBuffer b");
+        cl_mem cBuffer = clCreateBuffer(worker.context(), CL_MEM_WRITE_ONLY, biteSize, 0, &retCode);
+        asyncCheck(retCode, "clCreateBuffer c");
+
+        asyncCheck(clSetKernelArg(kernel, 0, sizeof(cl_uint), &n), "clSetKernelArg n");
+        asyncCheck(clSetKernelArg(kernel, 1, sizeof(cl_mem), &aBuffer), "clSetKernelArg a");
+        asyncCheck(clSetKernelArg(kernel, 2, sizeof(cl_mem), &bBuffer), "clSetKernelArg b");
+        asyncCheck(clSetKernelArg(kernel, 3, sizeof(cl_mem), &cBuffer), "clSetKernelArg c");
+
+        cl_event event;
+        const size_t nRounded = (n + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+        const size_t nWorkItems[] = {nRounded, nRounded};
+        const size_t groupSizes[] = {BLOCK_SIZE, BLOCK_SIZE};
+
+        auto t0 = std::chrono::steady_clock::now();
+        asyncCheck(clEnqueueNDRangeKernel(queue, kernel, 2, 0, nWorkItems, groupSizes, 0, 0, &event), "clEnqueueNDRangeKernel");
+        clWaitForEvents(1, &event);
+        auto time = std::chrono::steady_clock::now() - t0;
+        asyncCheck(clEnqueueReadBuffer(queue, cBuffer, CL_TRUE, 0, biteSize, c, 0, 0, 0), "clEnqueueReadBuffer");
+
+        clReleaseEvent(event);
+        clReleaseMemObject(aBuffer);
+        clReleaseMemObject(bBuffer);
+        clReleaseMemObject(cBuffer);
+
+        return time;
+    });
+}
+
+
+// B prepared once for many products: zero-padded to a multiple of BLOCK_SIZE and stored as
+// BLOCK_SIZE x BLOCK_SIZE row-major tiles, tile-row by tile-row, which is the order both
+// omp_gemm_block_packed and gemm_block_packed walk it in. Given a service, the packed copy is
+// also uploaded once and stays resident in the service's context until the handle is destroyed.
+class PackedMatrix {
+public:
+    PackedMatrix(const cl_uint n, const float *b, ComputeService *service = nullptr)
+        : n_(n), tiles_((n + BLOCK_SIZE - 1) / BLOCK_SIZE), service_(service),
+          host_(static_cast<size_t>(tiles_) * tiles_ * BLOCK_SIZE * BLOCK_SIZE, 0.0f) {
+        for (cl_uint k = 0; k < n; ++k)
+            for (cl_uint j = 0; j < n; ++j)
+                host_[offset(k, j)] = b[k * n + j];
+
+        if (service && service->valid()) {
+            cl_int retCode = 0;
+            device_ = clCreateBuffer(service->context(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                     sizeof(float) * host_.size(), host_.data(), &retCode);
+            asyncCheck(retCode, "clCreateBuffer packed b");
+        }
+    }
+
+    PackedMatrix(const PackedMatrix&) = delete;
+    PackedMatrix& operator=(const PackedMatrix&) = delete;
+    ~PackedMatrix() { if (device_) clReleaseMemObject(device_); }
+
+    cl_uint n() const { return n_; }
+    cl_uint tiles() const { return tiles_; }
+    const float *tile(const cl_uint kk, const cl_uint jj) const {
+        return host_.data() + (static_cast<size_t>(kk) * tiles_ + jj) * BLOCK_SIZE * BLOCK_SIZE;
+    }
+    cl_mem device() const { return device_; }
+    // Whether the packed copy is resident in this service's context.
+    bool residentOn(const ComputeService& service) const { return device_ && service_ == &service; }
+
+private:
+    size_t offset(const cl_uint k, const cl_uint j) const {
+        return (static_cast<size_t>(k / BLOCK_SIZE) * tiles_ + j / BLOCK_SIZE) * BLOCK_SIZE * BLOCK_SIZE
+               + (k % BLOCK_SIZE) * BLOCK_SIZE + j % BLOCK_SIZE;
+    }
+
+    cl_uint n_;
+    cl_uint tiles_;
+    const ComputeService *service_;
+    HostVector<float> host_;
+    cl_mem device_ = nullptr;
+};
+
+
+// omp_gemm_block against a prepared B: every inner tile is one contiguous, unit-stride chunk.
+auto omp_gemm_block_packed(const cl_uint n, const float *a, const PackedMatrix& b, float *c) {
+    int i = 0, j = 0, k = 0, jj = 0, kk = 0;
+    float tmp;
+    int chunk = 1;
+    const int tiles = b.tiles(), size = static_cast<int>(n);
+
+    auto t0 = std::chrono::steady_clock::now();
+
+#pragma omp parallel shared(a, b, c, n, size, chunk) private(i, j, k, jj, kk, tmp)
+    {
+        #pragma omp for schedule (static, chunk)
+        for (jj = 0; jj < tiles; ++jj)
+        {
+            const int jEnd = ((jj + 1) * BLOCK_SIZE > size) ? size - jj * BLOCK_SIZE : BLOCK_SIZE;
+            for (kk = 0; kk < tiles; ++kk)
+            {
+                const float *bTile = b.tile(kk, jj);
+                const int kEnd = ((kk + 1) * BLOCK_SIZE > size) ? size - kk * BLOCK_SIZE : BLOCK_SIZE;
+                for (i = 0; i < size; i++)
+                {
+                    const float *aRow = a + i * n + kk * BLOCK_SIZE;
+                    for (j = 0; j < jEnd; j++)
+                    {
+                        tmp = 0.0f;
+                        for (k = 0; k < kEnd; k++)
+                        {
+                            tmp += aRow[k] * bTile[k * BLOCK_SIZE + j];
+                        }
+                        c[i * n + jj * BLOCK_SIZE + j] += tmp;
+                    }
+                }
+            }
+        }
+    }
+
+    return std::chrono::steady_clock::now() - t0;
+}
+
+
+// opencl_gemm_shared against a B prepared with the same service: only a is uploaded per call.
+// Any n: the range is rounded up to whole tiles like the other buffer kernels'. The job holds its
+// own reference to the resident B, so b may be destroyed before the job has run; a b prepared
+// without this service or for another n fails the job.
+std::future<ComputeService::Duration> opencl_gemm_packed_shared(ComputeService& service, const cl_uint n, const float *a,
+                                                                const PackedMatrix& b, float *c) {
+    // A B that is not resident here fails the job rather than binding a foreign or null buffer.
+    cl_mem bBuffer = b.residentOn(service) && b.n() == n ? b.device() : nullptr;
+    const cl_uint tiles = b.tiles();
+    // An invalid service drops the job without running it, so only a job that will run retains.
+    if (bBuffer && service.valid()) asyncCheck(clRetainMemObject(bBuffer), "clRetainMemObject packed b");
+    return service.submit([=](ServiceWorker& worker) {
+        if (!bBuffer) serviceFail("opencl_gemm_packed_shared: B was not prepared for this service and size");
+
+        cl_int retCode = 0;
+        const size_t biteSize = sizeof(float) * n * n;
+        cl_kernel kernel = worker.specializedKernel("gemm_block_packed_kernel.cl", "gemm_block_packed", shapeOptions({{"N", n}}));
+        cl_command_queue queue = worker.queue();
+
+        cl_mem aBuffer = clCreateBuffer(worker.context(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, biteSize, (void*)a, &retCode);
+        asyncCheck(retCode, "clCreateBuffer a");
+        cl_mem cBuffer = clCreateBuffer(worker.context(), CL_MEM_WRITE_ONLY, biteSize, 0, &retCode);
+        asyncCheck(retCode, "clCreateBuffer c");
+
+        asyncCheck(clSetKernelArg(kernel, 0, sizeof(cl_uint), &n), "clSetKernelArg n");
+        asyncCheck(clSetKernelArg(kernel, 1, sizeof(cl_mem), &aBuffer), "clSetKernelArg a");
+        asyncCheck(clSetKernelArg(kernel, 2, sizeof(cl_mem), &bBuffer), "clSetKernelArg b");
+        asyncCheck(clSetKernelArg(kernel, 3, sizeof(cl_mem), &cBuffer), "clSetKernelArg c");
+        asyncCheck(clSetKernelArg(kernel, 4, sizeof(cl_uint), &tiles), "clSetKernelArg tiles");
+
+        cl_event event = nullptr;
+        const size_t nRounded = static_cast<size_t>(tiles) * BLOCK_SIZE;
+        const size_t nWorkItems[] = {nRounded, nRounded};
+        const size_t groupSizes[] = {BLOCK_SIZE, BLOCK_SIZE};
+
+        auto t0 = std::chrono::steady_clock::now();
+        retCode = clEnqueueNDRangeKernel(queue, kernel, 2, 0, nWorkItems, groupSizes, 0, 0, &event);
+        asyncCheck(retCode, "clEnqueueNDRangeKernel");
+        if (!retCode) clWaitForEvents(1, &event);
+        auto time = std::chrono::steady_clock::now() - t0;
+        if (!retCode) asyncCheck(clEnqueueReadBuffer(queue, cBuffer, CL_TRUE, 0, biteSize, c, 0, 0, 0), "clEnqueueReadBuffer");
+
+        if (event) clReleaseEvent(event);
+        clReleaseMemObject(aBuffer);
+        clReleaseMemObject(bBuffer);
+        clReleaseMemObject(cBuffer);
+        if (retCode) serviceFail("opencl_gemm_packed_shared: the kernel could not be launched");
+
+        return time;
+    });
+}
@@ -0,0 +1,72 @@
+#define BLOCK_SIZE 16
+#define GROUP_SIZE 256
+
+// Size class n <= 16: one 256-item work-group holds 256 / (n * n) whole problems in local memory,
+// one work-item per output element.
+__kernel void gemm_batched_small(const uint n, const uint batch,
+                                 __global const float *a, const uint strideA,
+                                 __global const float *b, const uint strideB,
+                                 __global float *c, const uint strideC) {
+    const uint nn = n * n;
+    const uint perGroup = GROUP_SIZE / nn;
+    const uint lid = get_local_id(0);
+    const uint slot = lid / nn;
+    const uint idx = lid % nn;
+    const uint problem = get_group_id(0) * perGroup + slot;
+    const bool active = slot < perGroup && problem < batch;
+
+    __local float Asub[GROUP_SIZE];
+    __local float Bsub[GROUP_SIZE];
+
+    if (active) {
+        Asub[lid] = a[problem * strideA + idx];
+        Bsub[lid] = b[problem * strideB + idx];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (active) {
+        const uint i = idx / n;
+        const uint j = idx % n;
+        const uint base = slot * nn;
+        float result = 0.0f;
+        for (uint k = 0; k < n; ++k)
+            result += Asub[base + i * n + k] * Bsub[base + k * n + j];
+        c[problem * strideC + idx] = result;
+    }
+}
+
+// Size class 16 < n <= 128: one BLOCK_SIZE x BLOCK_SIZE work-group per output tile and problem
+// (third NDRange dimension); tiles past n are zero-filled, so n needs no particular multiple.
+__kernel void gemm_batched_tiled(const uint n, const uint batch,
+                                 __global const float *a, const uint strideA,
+                                 __global const float *b, const uint strideB,
+                                 __global float *c, const uint strideC) {
+    const uint col = get_local_id(0);
+    const uint row = get_local_id(1);
+    const uint globalCol = BLOCK_SIZE * get_group_id(0) + col;
+    const uint globalRow = BLOCK_SIZE * get_group_id(1) + row;
+    const uint problem = get_global_id(2);
+
+    __local float Asub[BLOCK_SIZE][BLOCK_SIZE];
+    __local float Bsub[BLOCK_SIZE][BLOCK_SIZE];
+
+    a += problem * strideA;
+    b += problem * strideB;
+
+    float result = 0.0f;
+    const uint nBlocks = (n + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    for (uint iBlock = 0; iBlock < nBlocks; ++iBlock) {
+        const uint tiledCol = BLOCK_SIZE * iBlock + col;
+        const uint tiledRow = BLOCK_SIZE * iBlock + row;
+        Asub[row][col] = (globalRow < n && tiledCol < n) ? a[globalRow * n + tiledCol] : 0.0f;
+        Bsub[row][col] = (tiledRow < n && globalCol < n) ? b[tiledRow * n + globalCol] : 0.0f;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        for (uint k = 0; k < BLOCK_SIZE; k++) {
+            result += Asub[row][k] * Bsub[k][col];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    if (globalRow < n && globalCol < n)
+        c[problem * strideC + globalRow * n + globalCol] = result;
+}
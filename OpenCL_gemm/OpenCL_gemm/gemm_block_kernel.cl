@@ -1,7 +1,20 @@
 #define BLOCK_SIZE 16
 
-__kernel void gemm_block(const uint n, __global float* a,
+// Built with -D N=<n> for a hot size (KernelJit), the tile loop has a constant trip count and, for
+// multiples of BLOCK_SIZE, the bounds checks and zero padding fold away.
+#ifdef N
+#define INSIDE(row, col) (N % BLOCK_SIZE == 0 || ((row) < N && (col) < N))
+#else
+#define INSIDE(row, col) ((row) < n && (col) < n)
+#endif
+
+__kernel void gemm_block(const uint nArg, __global float* a,
                          __global float* b, __global float* c) {
+#ifdef N
+    const uint n = N;
+#else
+    const uint n = nArg;
+#endif
     const uint row = get_local_id(0);
     const uint col = get_local_id(1);
 
@@ -12,18 +25,19 @@ __kernel void gemm_block(const uint n, __global float* a,
     __local float Bsub[BLOCK_SIZE][BLOCK_SIZE];
 
     float result = 0.0f;
-    const uint nBlocks = n / BLOCK_SIZE;
+    const uint nBlocks = (n + BLOCK_SIZE - 1) / BLOCK_SIZE;
 
     for (uint iBlock = 0; iBlock < nBlocks; ++iBlock) {
         const uint rowOfBlock = BLOCK_SIZE * iBlock + row;
         const uint columnOfBlock = BLOCK_SIZE * iBlock + col;
-        Asub[col][row] = a[globalRow * n + columnOfBlock];
-        Bsub[col][row] = b[rowOfBlock * n + globalCol];
+        Asub[col][row] = INSIDE(globalRow, columnOfBlock) ? a[globalRow * n + columnOfBlock] : 0.0f;
+        Bsub[col][row] = INSIDE(rowOfBlock, globalCol) ? b[rowOfBlock * n + globalCol] : 0.0f;
         barrier(CLK_LOCAL_MEM_FENCE);
         for (uint i = 0; i < BLOCK_SIZE; i++) {
               result += Asub[i][row] * Bsub[col][i];
         }
         barrier(CLK_LOCAL_MEM_FENCE);
     }
-    c[globalRow * n + globalCol] = result;
+    if (INSIDE(globalRow, globalCol))
+        c[globalRow * n + globalCol] = result;
 }
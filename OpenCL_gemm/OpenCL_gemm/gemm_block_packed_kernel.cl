@@ -0,0 +1,48 @@
+#define BLOCK_SIZE 16
+
+// Same tiling as gemm_block, but b is pre-packed: BLOCK_SIZE x BLOCK_SIZE tiles stored tile-row by
+// tile-row, each tile row-major, so a work-group loads every B tile from one contiguous 1 KB chunk.
+// b is zero-padded to whole tiles, so only the loads of a and the store of c need bounds checks.
+// Built with -D N=<n> for a hot size (KernelJit), the tile loop has a constant trip count and, for
+// multiples of BLOCK_SIZE, the bounds checks fold away.
+#ifdef N
+#define INSIDE(row, col) (N % BLOCK_SIZE == 0 || ((row) < N && (col) < N))
+#else
+#define INSIDE(row, col) ((row) < n && (col) < n)
+#endif
+
+// tiles is PackedMatrix::tiles(), the padded tile count of b per dimension.
+__kernel void gemm_block_packed(const uint nArg, __global const float* a,
+                                __global const float* bPacked, __global float* c, const uint tiles) {
+#ifdef N
+    const uint n = N;
+    const uint nBlocks = (N + BLOCK_SIZE - 1) / BLOCK_SIZE;
+#else
+    const uint n = nArg;
+    const uint nBlocks = tiles;
+#endif
+    const uint row = get_local_id(0);
+    const uint col = get_local_id(1);
+
+    const uint globalRow = BLOCK_SIZE * get_group_id(0) + row;
+    const uint globalCol = BLOCK_SIZE * get_group_id(1) + col;
+
+    __local float Asub[BLOCK_SIZE][BLOCK_SIZE];
+    __local float Bsub[BLOCK_SIZE][BLOCK_SIZE];
+
+    float result = 0.0f;
+
+    for (uint iBlock = 0; iBlock < nBlocks; ++iBlock) {
+        const uint columnOfBlock = BLOCK_SIZE * iBlock + col;
+        __global const float* bTile = bPacked + (iBlock * nBlocks + get_group_id(1)) * BLOCK_SIZE * BLOCK_SIZE;
+        Asub[col][row] = INSIDE(globalRow, columnOfBlock) ? a[globalRow * n + columnOfBlock] : 0.0f;
+        Bsub[col][row] = bTile[row * BLOCK_SIZE + col];
+        barrier(CLK_LOCAL_MEM_FENCE);
+        for (uint i = 0; i < BLOCK_SIZE; i++) {
+              result += Asub[i][row] * Bsub[col][i];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    if (INSIDE(globalRow, globalCol))
+        c[globalRow * n + globalCol] = result;
+}
@@ -0,0 +1,26 @@
+// A and B are packed four consecutive columns per CL_RGBA texel, zero-padded to a multiple of 4.
+// Every work-item produces C[row][4 * col4 .. 4 * col4 + 3]: one A texel covers four k, and the
+// four matching B texels each carry four output columns, so no fetched channel is discarded.
+
+__constant sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP | CLK_FILTER_NEAREST;
+
+__kernel void matrixMulImgRGBA(__write_only image2d_t C, __read_only image2d_t A, __read_only image2d_t B,
+                               const uint n) {
+    const int col4 = get_global_id(0);
+    const int row = get_global_id(1);
+    const int width4 = ((int)n + 3) / 4;
+
+    if (col4 >= width4 || row >= (int)n)
+        return;
+
+    float4 total = (float4)(0.0f);
+    for (int k4 = 0; k4 < width4; ++k4) {
+        const float4 a = read_imagef(A, sampler, (int2)(k4, row));
+        const int k = 4 * k4;
+        total += a.x * read_imagef(B, sampler, (int2)(col4, k));
+        total += a.y * read_imagef(B, sampler, (int2)(col4, k + 1));
+        total += a.z * read_imagef(B, sampler, (int2)(col4, k + 2));
+        total += a.w * read_imagef(B, sampler, (int2)(col4, k + 3));
+    }
+    write_imagef(C, (int2)(col4, row), total);
+}
@@ -1,14 +1,33 @@
 #include "gemm.h"
+#include "embedded_kernels.h"
 
 
 void print_matrix(const float *matrix, const cl_uint size, const cl_uint m, const char *message);
 void clear_matrix(float *matrix, const cl_uint size);
+float max_relative_error(const float *matrix, const float *reference, const cl_uint size);
+void verify_gemm(Verifier& verifier);
 
 
 int main() {
+    requestThreadBinding();
+    Verifier verifier;
+    TimingBaseline baseline("gemm_baseline.json");
+    const bool hasGPU = deviceAvailable(CL_DEVICE_TYPE_GPU);
+    const cl_device_type fastDevice = hasGPU ? CL_DEVICE_TYPE_GPU : CL_DEVICE_TYPE_CPU;
+    const std::string fastName = hasGPU ? "GPU" : "CPU";
+
+    std::cout << "Verification:" << std::endl;
+    verify_verifier(verifier);
+    verify_gemm(verifier);
+    std::cout << std::endl;
+
     const cl_uint n = BLOCK_SIZE * (2 << 5), m = 5;
     cl_int i, j;
-    float *a = new float[n * n], *b = new float[n * n], *c = new float[n * n];
+    HostBuffer<float> aMemory(n * n), bMemory(n * n), cMemory(n * n);
+    float *a = aMemory.data(), *b = bMemory.data(), *c = cMemory.data();
+    firstTouch(a, n, n);
+    firstTouch(b, n, n);
+    firstTouch(c, n, n);
 
     for (i = 0; i < n; ++i) {
         for (j = 0; j < n; ++j) {
@@ -18,20 +37,26 @@ int main() {
         }
     }
 
+    // Nominal work and traffic of one n x n GEMM for the hardware counter report
+    const double gemmFlops = 2.0 * n * n * n, gemmBytes = 3.0 * sizeof(float) * n * n;
+
     // OpenMP
-    auto ompTime = omp_gemm(n, a, b, c);
+    auto ompTime = measureCounters("omp_gemm", gemmFlops, gemmBytes, [&]() { return omp_gemm(n, a, b, c); });
     print_matrix(c, n, m, "OpenMP result:");
     clear_matrix(c, n);
 
     // OpenMP Block
-    auto ompBlockTime = omp_gemm_block(n, a, b, c);
+    auto ompBlockTime = measureCounters("omp_gemm_block", gemmFlops, gemmBytes, [&]() { return omp_gemm_block(n, a, b, c); });
     print_matrix(c, n, m, "OpenMP Block result:");
     clear_matrix(c, n);
 
     // OpenCL GPU
-    auto openCLGPUTime = opencl_gemm_gpu(n, a, b, c);
-    print_matrix(c, n, m, "OpenCL GPU result:");
-    clear_matrix(c, n);
+    decltype(ompTime) openCLGPUTime{};
+    if (hasGPU) {
+        openCLGPUTime = opencl_gemm_gpu(n, a, b, c);
+        print_matrix(c, n, m, "OpenCL GPU result:");
+        clear_matrix(c, n);
+    }
 
     // OpenCL CPU
     auto openCLCPUTime = opencl_gemm_cpu(n, a, b, c);
@@ -39,30 +64,125 @@ int main() {
     clear_matrix(c, n);
 
     // OpenCL GPU Block
-    auto openCLGPUBlockTime = opencl_gemm_block_gpu(n, a, b, c);
-    print_matrix(c, n, m, "OpenCL GPU Block result:");
-    clear_matrix(c, n);
+    decltype(ompTime) openCLGPUBlockTime{};
+    if (hasGPU) {
+        openCLGPUBlockTime = opencl_gemm_block_gpu(n, a, b, c);
+        print_matrix(c, n, m, "OpenCL GPU Block result:");
+        clear_matrix(c, n);
+    }
 
-    // OpenCL GPU Block
+    // OpenCL CPU Block
     auto openCLCPUBlockTime = opencl_gemm_block_cpu(n, a, b, c);
     print_matrix(c, n, m, "OpenCL CPU Block result:");
     clear_matrix(c, n);
 
     // OpenCL GPU (image)
-    auto openCLGPUImageTime = opencl_gemm_gpu_image(n, a, b, c);
-    print_matrix(c, n, m, "OpenCL GPU (image) result:");
-    clear_matrix(c, n);
+    decltype(ompTime) openCLGPUImageTime{};
+    if (hasGPU) {
+        openCLGPUImageTime = opencl_gemm_gpu_image(n, a, b, c);
+        print_matrix(c, n, m, "OpenCL GPU (image) result:");
+        clear_matrix(c, n);
+    }
 
     // OpenCL CPU (image)
     auto openCLCPUImageTime = opencl_gemm_cpu_image(n, a, b, c);
     print_matrix(c, n, m, "OpenCL CPU (image) result:");
     clear_matrix(c, n);
 
+    // OpenCL GPU (RGBA image)
+    decltype(ompTime) openCLGPUImageRGBATime{};
+    if (hasGPU) {
+        openCLGPUImageRGBATime = opencl_gemm_gpu_image_rgba(n, a, b, c);
+        print_matrix(c, n, m, "OpenCL GPU (RGBA image) result:");
+        clear_matrix(c, n);
+    }
+
+    // OpenCL CPU (RGBA image)
+    auto openCLCPUImageRGBATime = opencl_gemm_cpu_image_rgba(n, a, b, c);
+    print_matrix(c, n, m, "OpenCL CPU (RGBA image) result:");
+    clear_matrix(c, n);
+
+    // OpenCL async: all buffer variants on both devices are in flight at once
+    HostBuffer<float> cAsyncMemory[] = {HostBuffer<float>(n * n), HostBuffer<float>(n * n),
+                                        HostBuffer<float>(n * n), HostBuffer<float>(n * n)};
+    float *cAsync[] = {cAsyncMemory[0].data(), cAsyncMemory[1].data(), cAsyncMemory[2].data(), cAsyncMemory[3].data()};
+    const std::string asyncNames[] = {"OpenCL " + fastName + " (async) result:", "OpenCL CPU (async) result:",
+                                      "OpenCL " + fastName + " Block (async) result:", "OpenCL CPU Block (async) result:"};
+    std::chrono::steady_clock::duration openCLAsyncTime{};
+    if (deviceAvailable(CL_DEVICE_TYPE_CPU)) {
+        AsyncScheduler gpuScheduler(fastDevice), cpuScheduler(CL_DEVICE_TYPE_CPU);
+        for (AsyncScheduler *scheduler : {&gpuScheduler, &cpuScheduler}) {
+            scheduler->kernel("gemm_kernel.cl", "gemm");
+            scheduler->kernel("gemm_block_kernel.cl", "gemm_block");
+        }
+
+        auto t0 = std::chrono::steady_clock::now();
+        std::vector<AsyncEvent> done = {
+            opencl_gemm_async(gpuScheduler, n, a, b, cAsync[0], "gemm_kernel.cl", "gemm"),
+            opencl_gemm_async(cpuScheduler, n, a, b, cAsync[1], "gemm_kernel.cl", "gemm"),
+            opencl_gemm_async(gpuScheduler, n, a, b, cAsync[2], "gemm_block_kernel.cl", "gemm_block"),
+            opencl_gemm_async(cpuScheduler, n, a, b, cAsync[3], "gemm_block_kernel.cl", "gemm_block")
+        };
+        waitAll(done);
+        openCLAsyncTime = std::chrono::steady_clock::now() - t0;
+
+        for (i = 0; i < 4; ++i)
+            print_matrix(cAsync[i], n, m, asyncNames[i].c_str());
+    } else {
+        std::cout << "OpenCL async: SKIPPED (no device)" << std::endl;
+    }
+
+    // Batched small products: one launch for the whole batch
+    const cl_uint batchSizes[] = {8, 64};
+    const cl_uint batchCounts[] = {4096, 512};
+    std::chrono::steady_clock::duration ompBatchedTime[2], openCLGPUBatchedTime[2], openCLCPUBatchedTime[2];
+    for (i = 0; i < 2; ++i) {
+        const cl_uint bn = batchSizes[i], batch = batchCounts[i], nn = bn * bn;
+        HostVector<float> batchA(nn * batch), batchB(nn * batch), batchC(nn * batch);
+        for (size_t e = 0; e < batchA.size(); ++e) {
+            batchA[e] = ((e % nn) / bn == (e % nn) % bn) ? 1.0f : 0.0f;
+            batchB[e] = ((e % nn) / bn == (e % nn) % bn) ? 2.0f : 0.0f;
+        }
+
+        ompBatchedTime[i] = omp_gemm_strided_batched(bn, batch, batchA.data(), nn, batchB.data(), nn, batchC.data(), nn);
+        print_matrix(batchC.data() + nn * (batch - 1), bn, m, "OpenMP batched result (last problem):");
+        openCLGPUBatchedTime[i] = {};
+        if (hasGPU) {
+            openCLGPUBatchedTime[i] = opencl_gemm_strided_batched_gpu(bn, batch, batchA.data(), nn, batchB.data(), nn, batchC.data(), nn);
+            print_matrix(batchC.data() + nn * (batch - 1), bn, m, "OpenCL GPU batched result (last problem):");
+        }
+        openCLCPUBatchedTime[i] = opencl_gemm_strided_batched_cpu(bn, batch, batchA.data(), nn, batchB.data(), nn, batchC.data(), nn);
+        print_matrix(batchC.data() + nn * (batch - 1), bn, m, "OpenCL CPU batched result (last problem):");
+    }
+
+    // Strassen-Winograd on random matrices against the classical blocked product
+    HostVector<float> randomA(n * n), randomB(n * n), classical(n * n, 0.0f), strassen(n * n);
+    for (size_t e = 0; e < randomA.size(); ++e) {
+        randomA[e] = (rand() % 2001) / 1000.0f - 1.0f;
+        randomB[e] = (rand() % 2001) / 1000.0f - 1.0f;
+    }
+    auto classicalTime = omp_gemm_block(n, randomA.data(), randomB.data(), classical.data());
+    const cl_uint cutoffs[] = {64, 128, 256, 512};
+    std::chrono::steady_clock::duration strassenTime[4];
+    float strassenError[4];
+    for (i = 0; i < 4; ++i) {
+        strassenTime[i] = strassen_gemm_block(n, randomA.data(), randomB.data(), strassen.data(), cutoffs[i]);
+        strassenError[i] = max_relative_error(strassen.data(), classical.data(), n);
+    }
+
     // Total OpenMP
     std::cout << "\nTime OpenMP:\n"
               << "OpenMP       " << std::chrono::duration_cast<std::chrono::milliseconds>(ompTime).count() << " ms\n"
               << "OpenMP Block " << std::chrono::duration_cast<std::chrono::milliseconds>(ompBlockTime).count() << " ms\n";
 
+    // Total Strassen
+    std::cout << "\nTime Strassen-Winograd (random input, error relative to OpenMP Block):\n"
+              << "OpenMP Block        " << std::chrono::duration_cast<std::chrono::milliseconds>(classicalTime).count() << " ms\n";
+    for (i = 0; i < 4; ++i)
+        std::cout << "Strassen cutoff " << cutoffs[i] << (cutoffs[i] < 100 ? "  " : " ")
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(strassenTime[i]).count() << " ms, error "
+                  << strassenError[i] << "\n";
+
     // Total OpenCL
     std::cout << "\nTime OpenCL (buffer):\n"
               << "OpenCL GPU       " << std::chrono::duration_cast<std::chrono::milliseconds>(openCLGPUTime).count() << " ms\n"
@@ -73,11 +193,76 @@ int main() {
     // Total OpenCL with images instead of buffers
     std::cout << "\nTime OpenCL (image):\n"
               << "OpenCL GPU       " << std::chrono::duration_cast<std::chrono::milliseconds>(openCLGPUImageTime).count() << " ms\n"
-              << "OpenCL CPU       " << std::chrono::duration_cast<std::chrono::milliseconds>(openCLCPUImageTime).count() << " ms\n";
+              << "OpenCL CPU       " << std::chrono::duration_cast<std::chrono::milliseconds>(openCLCPUImageTime).count() << " ms\n"
+              << "OpenCL GPU RGBA  " << std::chrono::duration_cast<std::chrono::milliseconds>(openCLGPUImageRGBATime).count() << " ms\n"
+              << "OpenCL CPU RGBA  " << std::chrono::duration_cast<std::chrono::milliseconds>(openCLCPUImageRGBATime).count() << " ms\n";
+
+    // Total batched
+    for (i = 0; i < 2; ++i) {
+        std::cout << "\nTime batched (" << batchCounts[i] << " x " << batchSizes[i] << "x" << batchSizes[i] << "):\n"
+                  << "OpenMP     " << std::chrono::duration_cast<std::chrono::milliseconds>(ompBatchedTime[i]).count() << " ms\n"
+                  << "OpenCL GPU " << std::chrono::duration_cast<std::chrono::milliseconds>(openCLGPUBatchedTime[i]).count() << " ms\n"
+                  << "OpenCL CPU " << std::chrono::duration_cast<std::chrono::milliseconds>(openCLCPUBatchedTime[i]).count() << " ms\n";
+    }
+
+    // Total OpenCL with all buffer variants overlapped
+    std::cout << "\nTime OpenCL (async):\n"
+              << "OpenCL GPU + CPU, plain + block " << std::chrono::duration_cast<std::chrono::milliseconds>(openCLAsyncTime).count() << " ms\n";
+
+    // Stress: 1..64 client threads sharing one context and program set through the service
+    const cl_uint stressN = 4 * BLOCK_SIZE;
+    HostVector<float> stressA(stressN * stressN, 1.0f), stressB(stressN * stressN, 1.0f);
+    ComputeService service(fastDevice, 4);
+    opencl_gemm_shared(service, stressN, stressA.data(), stressB.data(), c, "gemm_block_kernel.cl", "gemm_block").wait();
+
+    std::cout << "\nThroughput OpenCL " << fastName << " Block (shared service, n = " << stressN << "):\n";
+    for (unsigned clients = 1; clients <= 64; clients *= 2) {
+        const double rate = measureThroughput(clients, 32, [&]() {
+            thread_local HostVector<float> stressC(stressN * stressN);
+            return opencl_gemm_shared(service, stressN, stressA.data(), stressB.data(), stressC.data(),
+                                      "gemm_block_kernel.cl", "gemm_block");
+        });
+        std::cout << "clients " << clients << "\t" << static_cast<long long>(rate) << " req/s\n";
+    }
+
+    // Repeated products against the same B, prepared once
+    const int repeats = 4;
+    PackedMatrix bPacked(n, b, &service);
+    std::chrono::steady_clock::duration ompPackedTime{}, openCLPackedTime{};
+    for (int r = 0; r < repeats; ++r) {
+        clear_matrix(c, n);
+        ompPackedTime += omp_gemm_block_packed(n, a, bPacked, c);
+    }
+    print_matrix(c, n, m, "OpenMP Block (packed B) result:");
+    for (int r = 0; r < repeats; ++r)
+        openCLPackedTime += opencl_gemm_packed_shared(service, n, a, bPacked, c).get();
+    print_matrix(c, n, m, ("OpenCL " + fastName + " Block (packed B) result:").c_str());
 
-    delete[] a, b, c;
+    std::cout << "\nTime per call with prepared B:\n"
+              << "OpenMP Block     " << std::chrono::duration_cast<std::chrono::milliseconds>(ompPackedTime / repeats).count() << " ms\n"
+              << "OpenCL " << fastName << " Block " << std::chrono::duration_cast<std::chrono::milliseconds>(openCLPackedTime / repeats).count() << " ms\n";
 
-    return 0;
+    baseline.record("omp_gemm", ompTime);
+    baseline.record("omp_gemm_block", ompBlockTime);
+    baseline.record("opencl_gemm CPU", openCLCPUTime);
+    baseline.record("opencl_gemm_block CPU", openCLCPUBlockTime);
+    baseline.record("opencl_gemm_image CPU", openCLCPUImageTime);
+    baseline.record("opencl_gemm_image_rgba CPU", openCLCPUImageRGBATime);
+    if (hasGPU) {
+        baseline.record("opencl_gemm GPU", openCLGPUTime);
+        baseline.record("opencl_gemm_block GPU", openCLGPUBlockTime);
+        baseline.record("opencl_gemm_image GPU", openCLGPUImageTime);
+        baseline.record("opencl_gemm_image_rgba GPU", openCLGPUImageRGBATime);
+    }
+    baseline.record("strassen_gemm_block cutoff 256", strassenTime[2]);
+    baseline.record("omp_gemm_strided_batched 8x8", ompBatchedTime[0]);
+    baseline.record("opencl_gemm_strided_batched CPU 8x8", openCLCPUBatchedTime[0]);
+    baseline.compare(verifier);
+    baseline.save();
+
+    std::cout << "\n" << (verifier.failures() ? "FAILED" : "PASSED") << std::endl;
+
+    return verifier.failures() ? 1 : 0;
 }
 
 
@@ -96,3 +281,121 @@ void clear_matrix(float *matrix, const cl_uint size) {
         for (cl_uint j = 0; j < size; ++j)
             matrix[i * size + j] = 0.0f;
 }
+
+
+float max_relative_error(const float *matrix, const float *reference, const cl_uint size) {
+    float error = 0.0f, scale = 0.0f;
+    for (size_t i = 0; i < static_cast<size_t>(size) * size; ++i) {
+        error = std::max(error, std::abs(matrix[i] - reference[i]));
+        scale = std::max(scale, std::abs(reference[i]));
+    }
+
+    return scale > 0.0f ? error / scale : error;
+}
+
+
+// Every backend against a double-precision reference on random matrices, including sizes that are
+// odd or not a multiple of BLOCK_SIZE.
+void verify_gemm(Verifier& verifier) {
+    const cl_uint sizes[] = {16, 33, 100, 128};
+    const double tolerance = 1e-4, strassenTolerance = 1e-3;
+    const bool hasCPU = deviceAvailable(CL_DEVICE_TYPE_CPU), hasGPU = deviceAvailable(CL_DEVICE_TYPE_GPU);
+
+    AsyncScheduler scheduler(CL_DEVICE_TYPE_CPU);
+    ComputeService service(CL_DEVICE_TYPE_CPU, 2);
+    // Specialize from the first call, so the checks cover the KernelJit kernels too; the generic
+    // ones run in the non-shared variants.
+    service.jit().setHotCalls(1);
+
+    for (const cl_uint n : sizes) {
+        const size_t nn = static_cast<size_t>(n) * n;
+        HostVector<float> a(nn), b(nn), c(nn);
+        fillRandom(a, 3 * n);
+        fillRandom(b, 3 * n + 1);
+
+        auto multiply = [n](const float *x, const float *y, double *z) {
+            std::fill(z, z + static_cast<size_t>(n) * n, 0.0);
+            for (cl_uint i = 0; i < n; ++i)
+                for (cl_uint k = 0; k < n; ++k)
+                    for (cl_uint j = 0; j < n; ++j)
+                        z[i * n + j] += static_cast<double>(x[i * n + k]) * y[k * n + j];
+        };
+        std::vector<double> reference(nn);
+        multiply(a.data(), b.data(), reference.data());
+
+        const std::string suffix = " (n = " + std::to_string(n) + ")";
+        auto run = [&](const std::string& name, const bool available, const char *reason, auto backend,
+                       const double limit) {
+            if (!available) {
+                verifier.skip(name + suffix, reason);
+                return;
+            }
+            std::fill(c.begin(), c.end(), 0.0f);
+            backend();
+            verifier.check(name + suffix, maxError(nn, c.data(), reference.data()), limit);
+        };
+
+        run("omp_gemm", true, "", [&]() { omp_gemm(n, a.data(), b.data(), c.data()); }, tolerance);
+        run("omp_gemm_block", true, "", [&]() { omp_gemm_block(n, a.data(), b.data(), c.data()); }, tolerance);
+        run("opencl_gemm CPU", hasCPU, "no device", [&]() { opencl_gemm_cpu(n, a.data(), b.data(), c.data()); }, tolerance);
+        run("opencl_gemm GPU", hasGPU, "no device", [&]() { opencl_gemm_gpu(n, a.data(), b.data(), c.data()); }, tolerance);
+        run("opencl_gemm_block CPU", hasCPU, "no device", [&]() { opencl_gemm_block_cpu(n, a.data(), b.data(), c.data()); }, tolerance);
+        run("opencl_gemm_block GPU", hasGPU, "no device", [&]() { opencl_gemm_block_gpu(n, a.data(), b.data(), c.data()); }, tolerance);
+        run("opencl_gemm_image CPU", hasCPU, "no device", [&]() { opencl_gemm_cpu_image(n, a.data(), b.data(), c.data()); }, tolerance);
+        run("opencl_gemm_image GPU", hasGPU, "no device", [&]() { opencl_gemm_gpu_image(n, a.data(), b.data(), c.data()); }, tolerance);
+        run("opencl_gemm_image_rgba CPU", hasCPU, "no device", [&]() { opencl_gemm_cpu_image_rgba(n, a.data(), b.data(), c.data()); }, tolerance);
+        run("opencl_gemm_image_rgba GPU", hasGPU, "no device", [&]() { opencl_gemm_gpu_image_rgba(n, a.data(), b.data(), c.data()); }, tolerance);
+        run("opencl_gemm_async CPU", hasCPU, "no device", [&]() {
+            opencl_gemm_async(scheduler, n, a.data(), b.data(), c.data(), "gemm_block_kernel.cl", "gemm_block").wait();
+        }, tolerance);
+        run("opencl_gemm_shared CPU", hasCPU, "no device", [&]() {
+            opencl_gemm_shared(service, n, a.data(), b.data(), c.data(), "gemm_block_kernel.cl", "gemm_block").wait();
+        }, tolerance);
+
+        PackedMatrix bPacked(n, b.data(), &service);
+        run("omp_gemm_block_packed", true, "", [&]() { omp_gemm_block_packed(n, a.data(), bPacked, c.data()); }, tolerance);
+        run("opencl_gemm_packed_shared CPU", hasCPU, "no device",
+            [&]() { opencl_gemm_packed_shared(service, n, a.data(), bPacked, c.data()).wait(); }, tolerance);
+
+        run("strassen_gemm_block", true, "", [&]() { strassen_gemm_block(n, a.data(), b.data(), c.data(), 16); }, strassenTolerance);
+
+        // Batch of three: the same product at both ends and an unrelated one in the middle.
+        const cl_uint batch = 3;
+        HostVector<float> batchA(nn * batch), batchB(nn * batch), batchC(nn * batch);
+        fillRandom(batchA, 5);
+        fillRandom(batchB, 6);
+        std::copy(a.begin(), a.end(), batchA.begin());
+        std::copy(b.begin(), b.end(), batchB.begin());
+        std::copy(a.begin(), a.end(), batchA.begin() + 2 * nn);
+        std::copy(b.begin(), b.end(), batchB.begin() + 2 * nn);
+        std::vector<double> batchReference(nn * batch);
+        for (cl_uint p = 0; p < batch; ++p)
+            multiply(batchA.data() + p * nn, batchB.data() + p * nn, batchReference.data() + p * nn);
+
+        // batchC starts as NaN, so a backend that leaves any problem unwritten fails.
+        auto runBatched = [&](const std::string& name, const bool available, auto backend) {
+            if (!available) {
+                verifier.skip(name + suffix, "no device");
+                return;
+            }
+            std::fill(batchC.begin(), batchC.end(), NAN);
+            backend();
+            verifier.check(name + suffix, maxError(nn * batch, batchC.data(), batchReference.data()), tolerance);
+        };
+        const float *aPointers[] = {batchA.data(), batchA.data() + nn, batchA.data() + 2 * nn};
+        const float *bPointers[] = {batchB.data(), batchB.data() + nn, batchB.data() + 2 * nn};
+        float *cPointers[] = {batchC.data(), batchC.data() + nn, batchC.data() + 2 * nn};
+
+        runBatched("omp_gemm_strided_batched", true, [&]() {
+            omp_gemm_strided_batched(n, batch, batchA.data(), nn, batchB.data(), nn, batchC.data(), nn);
+        });
+        runBatched("omp_gemm_batched", true, [&]() { omp_gemm_batched(n, batch, aPointers, bPointers, cPointers); });
+        runBatched("opencl_gemm_strided_batched CPU", hasCPU, [&]() {
+            opencl_gemm_strided_batched_cpu(n, batch, batchA.data(), nn, batchB.data(), nn, batchC.data(), nn);
+        });
+        runBatched("opencl_gemm_strided_batched GPU", hasGPU, [&]() {
+            opencl_gemm_strided_batched_gpu(n, batch, batchA.data(), nn, batchB.data(), nn, batchC.data(), nn);
+        });
+        runBatched("opencl_gemm_batched CPU", hasCPU, [&]() { opencl_gemm_batched_cpu(n, batch, aPointers, bPointers, cPointers); });
+    }
+}